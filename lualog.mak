@@ -8,7 +8,7 @@ TARGET_NAME = lualog
 UNAME_S = $(shell uname -s)
 
 #伪目标
-.PHONY: clean all target pre_build post_build
+.PHONY: clean all target test bench tools pre_build post_build
 all : pre_build target post_build
 
 #CFLAG
@@ -52,6 +52,8 @@ endif
 LIBS += -llua
 ifeq ($(UNAME_S), Linux)
 LIBS += -lstdc++fs
+LIBS += -lz
+LIBS += -lrt
 endif
 #系统库
 LIBS += -lm -ldl -lstdc++ -lpthread
@@ -120,6 +122,55 @@ $(TARGET_DYNAMIC) : $(OBJS)
 #target伪目标
 target : $(TARGET_DYNAMIC)
 
+#test伪目标，测试程序不链接mimalloc以便统计内存分配
+TEST_CXXFLAGS = -g -O2 -Wall -Wno-deprecated $(STDCPP) -I../lua/lua -I../fmt/include -I../luakit/include -Ilualog -DFMT_HEADER_ONLY
+TEST_ALLOC = $(TARGET_DIR)/alloc_test
+$(TEST_ALLOC) : test/alloc_test.cpp lualog/logger.cpp
+	$(CX) $(TEST_CXXFLAGS) -o $@ $^ -lstdc++fs -lz -lrt -lpthread
+TEST_QUEUE = $(TARGET_DIR)/queue_test
+$(TEST_QUEUE) : test/queue_test.cpp lualog/logger.cpp
+	$(CX) $(TEST_CXXFLAGS) -o $@ $^ -lstdc++fs -lz -lrt -lpthread
+TEST_FORMAT = $(TARGET_DIR)/format_test
+$(TEST_FORMAT) : test/format_test.cpp lualog/logger.cpp
+	$(CX) $(TEST_CXXFLAGS) -o $@ $^ -lstdc++fs -lz -lrt -lpthread
+TEST_JSON = $(TARGET_DIR)/json_test
+$(TEST_JSON) : test/json_test.cpp lualog/logger.cpp
+	$(CX) $(TEST_CXXFLAGS) -o $@ $^ -lstdc++fs -lz -lrt -lpthread
+TEST_LIMIT = $(TARGET_DIR)/limit_test
+$(TEST_LIMIT) : test/limit_test.cpp lualog/logger.cpp
+	$(CX) $(TEST_CXXFLAGS) -o $@ $^ -lstdc++fs -lz -lrt -lpthread
+TEST_INDEX = $(TARGET_DIR)/index_test
+$(TEST_INDEX) : test/index_test.cpp lualog/logger.cpp
+	$(CX) $(TEST_CXXFLAGS) -o $@ $^ -lstdc++fs -lz -lrt -lpthread
+test : pre_build $(TEST_ALLOC) $(TEST_QUEUE) $(TEST_FORMAT) $(TEST_JSON) $(TEST_LIMIT) $(TEST_INDEX)
+	$(TEST_ALLOC)
+	$(TEST_QUEUE)
+	$(TEST_FORMAT)
+	$(TEST_JSON)
+	$(TEST_LIMIT)
+	$(TEST_INDEX)
+
+#bench伪目标
+BENCH_WRITE = $(TARGET_DIR)/write_bench
+$(BENCH_WRITE) : test/write_bench.cpp lualog/logger.cpp
+	$(CX) $(TEST_CXXFLAGS) -o $@ $^ -lstdc++fs -lz -lrt -lpthread
+BENCH_FORMAT = $(TARGET_DIR)/format_bench
+$(BENCH_FORMAT) : test/format_bench.cpp lualog/logger.cpp
+	$(CX) $(TEST_CXXFLAGS) -o $@ $^ -lstdc++fs -lz -lrt -lpthread
+BENCH_LOG = $(TARGET_DIR)/log_bench
+$(BENCH_LOG) : test/log_bench.cpp lualog/logger.cpp lualog/lualog.cpp
+	$(CX) $(TEST_CXXFLAGS) -o $@ $^ -L$(SOLUTION_DIR)library -llua -lstdc++fs -lz -lrt -lm -ldl -lpthread
+bench : pre_build $(BENCH_WRITE) $(BENCH_FORMAT) $(BENCH_LOG)
+	$(BENCH_WRITE)
+	$(BENCH_FORMAT)
+	$(BENCH_LOG) 4 200000 $(TARGET_DIR)/log_bench.json
+
+#tools伪目标
+LOG_QUERY = $(TARGET_DIR)/log_query
+$(LOG_QUERY) : tools/log_query.cpp lualog/logger.cpp
+	$(CX) $(TEST_CXXFLAGS) -o $@ $^ -lstdc++fs -lz -lrt -lpthread
+tools : pre_build $(LOG_QUERY)
+
 #clean伪目标
 clean :
 	rm -rf $(INT_DIR)
@@ -10,36 +10,387 @@ namespace logger {
     // --------------------------------------------------------------------------------
     log_time log_time::now() {
         system_clock::duration dur = system_clock::now().time_since_epoch();
-        time_t time = duration_cast<seconds>(dur).count();
-        auto time_ms = duration_cast<milliseconds>(dur).count();
-        return log_time(*std::localtime(&time), time, time_ms % 1000);
+        auto time_us = duration_cast<microseconds>(dur).count();
+        return log_time(time_us / 1000000, (time_us / 1000) % 1000, time_us);
+    }
+
+    const std::tm& log_time::localtime(time_t time) {
+        thread_local time_t t_time = -1;
+        thread_local std::tm t_tm = {};
+        if (time != t_time) {
+            //每分钟重新加载时区，兼容运行中修改时区和夏令时切换
+            if (t_time < 0 || time / 60 != t_time / 60) {
+#ifdef WIN32
+                _tzset();
+#else
+                tzset();
+#endif
+            }
+#ifdef WIN32
+            localtime_s(&t_tm, &time);
+#else
+            localtime_r(&time, &t_tm);
+#endif
+            t_time = time;
+        }
+        return t_tm;
+    }
+
+    // class log_interner
+    // --------------------------------------------------------------------------------
+    struct intern_table {
+        spin_mutex mutex;
+        std::unordered_set<sstring> strings;
+    };
+
+    static vstring intern_in(intern_table& table, std::unordered_map<vstring, vstring>& cache, vstring str, size_t limit) {
+        //线程缓存命中时不加锁也不分配内存
+        auto it = cache.find(str);
+        if (it != cache.end()) {
+            return it->second;
+        }
+        std::unique_lock<spin_mutex> lock(table.mutex);
+        auto sit = table.strings.find(sstring(str));
+        if (sit == table.strings.end()) {
+            if (limit > 0 && table.strings.size() >= limit) {
+                return vstring();
+            }
+            sit = table.strings.emplace(str).first;
+        }
+        vstring interned = *sit;
+        lock.unlock();
+        cache.emplace(interned, interned);
+        return interned;
+    }
+
+    vstring log_interner::intern(vstring str, size_t limit) {
+        static intern_table s_names;
+        thread_local std::unordered_map<vstring, vstring> t_cache;
+        return intern_in(s_names, t_cache, str, limit);
+    }
+
+    vstring log_interner::intern_format(vstring vfmt) {
+        static intern_table s_formats;
+        thread_local std::unordered_map<vstring, vstring> t_cache;
+        return intern_in(s_formats, t_cache, vfmt, FMT_INTERN);
+    }
+
+    // class log_feature
+    // --------------------------------------------------------------------------------
+    uint32_t log_feature::id(vstring feature) {
+        if (feature.empty()) return 0;
+        //驻留字符串地址唯一，线程缓存按地址查找
+        thread_local std::unordered_map<cpchar, uint32_t> t_cache;
+        auto it = t_cache.find(feature.data());
+        if (it != t_cache.end()) {
+            return it->second;
+        }
+        static spin_mutex s_mutex;
+        static std::unordered_map<vstring, uint32_t> s_ids;
+        std::unique_lock<spin_mutex> lock(s_mutex);
+        auto sit = s_ids.emplace(feature, (uint32_t)s_ids.size() + 1).first;
+        uint32_t id = sit->second;
+        lock.unlock();
+        t_cache.emplace(feature.data(), id);
+        return id;
+    }
+
+    // class log_format
+    // --------------------------------------------------------------------------------
+    const log_format& log_format::find(vstring vfmt) {
+        thread_local std::unordered_map<vstring, log_format> t_formats;
+        auto it = t_formats.find(vfmt);
+        if (it != t_formats.end()) {
+            return it->second;
+        }
+        vstring interned = log_interner::intern_format(vfmt);
+        if (interned.data() == nullptr) {
+            //驻留已满，临时解析不缓存
+            thread_local log_format t_format;
+            t_format.parse(vfmt);
+            return t_format;
+        }
+        auto& format = t_formats[interned];
+        format.parse(interned);
+        return format;
+    }
+
+    void log_format::parse(vstring vfmt) {
+        fmt_ = vfmt;
+        fallback_ = false;
+        pieces_.clear();
+        int32_t next_arg = 0;
+        bool auto_index = false, manual_index = false;
+        size_t pos = 0, start = 0, size = vfmt.size();
+        auto literal = [&](size_t end) {
+            if (end > start) pieces_.push_back({ vfmt.substr(start, end - start) });
+        };
+        while (pos < size) {
+            char c = vfmt[pos];
+            if (c != '{' && c != '}') {
+                ++pos;
+                continue;
+            }
+            //转义的"{{"和"}}"
+            if (pos + 1 < size && vfmt[pos + 1] == c) {
+                literal(pos + 1);
+                start = pos = pos + 2;
+                continue;
+            }
+            size_t close = vfmt.find('}', pos);
+            if (c == '}' || close == vstring::npos || vfmt.find('{', pos + 1) < close) {
+                //非法格式或嵌套的动态宽度，交给fmt处理
+                fallback_ = true;
+                return;
+            }
+            literal(pos);
+            vstring field = vfmt.substr(pos + 1, close - pos - 1);
+            size_t colon = field.find(':');
+            vstring id = field.substr(0, colon);
+            piece field_piece;
+            if (id.empty()) {
+                auto_index = true;
+                field_piece.arg = next_arg++;
+            } else if (id.find_first_not_of("0123456789") == vstring::npos && id.size() < 6) {
+                manual_index = true;
+                field_piece.arg = std::stoi(sstring(id));
+            } else {
+                fallback_ = true;
+                return;
+            }
+            if (auto_index && manual_index) {
+                fallback_ = true;
+                return;
+            }
+            if (colon != vstring::npos) {
+                field_piece.spec = fmt::format("{{{}}}", field.substr(colon));
+            }
+            pieces_.push_back(std::move(field_piece));
+            start = pos = close + 1;
+        }
+        literal(pos);
+    }
+
+    void log_format::format(fmt::memory_buffer& buf, const format_args& args) const {
+        auto out = std::back_inserter(buf);
+        if (fallback_) {
+            fmt::vformat_to(out, fmt::string_view(fmt_.data(), fmt_.size()), args);
+            return;
+        }
+        for (auto& piece : pieces_) {
+            if (piece.arg < 0) {
+                buf.append(piece.text.data(), piece.text.data() + piece.text.size());
+                continue;
+            }
+            auto arg = args.get(piece.arg);
+            if (!arg) {
+                throw fmt::format_error("argument not found");
+            }
+            if (!piece.spec.empty()) {
+                fmt::vformat_to(out, piece.spec, format_args(&arg, 1));
+                continue;
+            }
+            //无格式说明的字符串和整数直接追加
+            fmt::visit_format_arg([&](auto value) {
+                using T = decltype(value);
+                if constexpr (std::is_same_v<T, fmt::string_view>) {
+                    buf.append(value.data(), value.data() + value.size());
+                } else if constexpr (std::is_same_v<T, int> || std::is_same_v<T, unsigned>
+                    || std::is_same_v<T, long long> || std::is_same_v<T, unsigned long long>) {
+                    fmt::format_int value_str(value);
+                    buf.append(value_str.data(), value_str.data() + value_str.size());
+                } else {
+                    fmt::vformat_to(out, "{}", format_args(&arg, 1));
+                }
+            }, arg);
+        }
     }
 
     // class log_message
     // --------------------------------------------------------------------------------
-    void log_message::option(log_level level, sstring&& msg, cpchar tag, cpchar feature, cpchar source, int32_t line) {
+    void log_message::option(log_level level, vstring msg, cpchar tag, cpchar feature, cpchar source, int32_t line) {
         log_time_ = log_time::now();
-        feature_ = feature;
-        source_ = source;
+        set_names(tag, feature, source);
         level_ = level;
         line_ = line;
-        tag_ = tag;
-        msg_ = msg;
+        deferred_ = false;
+        replayed_ = false;
+        assign(msg);
+    }
+
+    void log_message::replay(log_level level, int64_t stamp, vstring msg, vstring tag, vstring source, int32_t line, cpchar feature, bool deferred, vstring vfmt) {
+        restore(level, stamp, msg, tag, feature, source, line, true);
+        deferred_ = deferred;
+        fmt_ = vfmt;
+    }
+
+    void log_message::restore(log_level level, int64_t stamp, vstring msg, vstring tag, vstring feature, vstring source, int32_t line, bool replayed) {
+        option(level, msg, "", "", "", line);
+        log_time_ = log_time(stamp / 1000000, (stamp / 1000) % 1000, stamp);
+        set_names(tag, feature, source);
+        replayed_ = replayed;
+    }
+
+    //动态拼接的tag等可能无限增长，超过驻留上限时复制到消息中
+    //注册目标的feature都已驻留，没有驻留的feature不会有目标，编号为0
+    void log_message::set_names(vstring tag, vstring feature, vstring source) {
+        tag_ = log_interner::intern(tag, NAME_INTERN);
+        feature_ = log_interner::intern(feature, NAME_INTERN);
+        source_ = log_interner::intern(source, NAME_INTERN);
+        feature_id_ = feature_.data() ? log_feature::id(feature_) : 0;
+        if (tag_.data() && feature_.data() && source_.data()) return;
+        //预留总长度，追加时不会重新分配，已生成的视图保持有效
+        names_.clear();
+        names_.reserve(tag.size() + feature.size() + source.size());
+        auto keep = [this](vstring& view, vstring str) {
+            if (view.data()) return;
+            size_t offset = names_.size();
+            names_.append(str);
+            view = vstring(names_.data() + offset, str.size());
+        };
+        keep(tag_, tag);
+        keep(feature_, feature);
+        keep(source_, source);
+    }
+
+    //参数类型标记
+    const char ARG_BOOL     = 'b';
+    const char ARG_NUMBER   = 'n';
+    const char ARG_INTEGER  = 'i';
+    const char ARG_STRING   = 's';
+
+    void log_message::defer(log_level level, vstring vfmt, cpchar tag, cpchar feature, cpchar source, int32_t line) {
+        option(level, "", tag, feature, source, line);
+        deferred_ = true;
+        //动态拼接的格式串可能无限增长，超过驻留上限时随参数一起记录
+        fmt_ = log_interner::intern_format(vfmt);
+        if (fmt_.data() == nullptr) {
+            push_arg(vfmt);
+        }
+    }
+
+    void log_message::push_arg(bool value) {
+        char arg[2] = { ARG_BOOL, (char)value };
+        append(arg, sizeof(arg));
+    }
+
+    void log_message::push_arg(double value) {
+        append(&ARG_NUMBER, 1);
+        append(&value, sizeof(value));
+    }
+
+    void log_message::push_arg(int64_t value) {
+        append(&ARG_INTEGER, 1);
+        append(&value, sizeof(value));
+    }
+
+    void log_message::push_arg(vstring value) {
+        uint32_t len = (uint32_t)value.size();
+        append(&ARG_STRING, 1);
+        append(&len, sizeof(len));
+        append(value.data(), len);
+    }
+
+    void log_message::resolve() {
+        thread_local fmt::memory_buffer t_buf;
+        thread_local fmt::dynamic_format_arg_store<fmt::format_context> t_store;
+        t_buf.clear();
+        t_store.clear();
+        vstring vfmt = fmt_;
+        vstring args = msg();
+        size_t pos = 0;
+        while (pos < args.size()) {
+            char type = args[pos++];
+            if (type == ARG_BOOL) {
+                t_store.push_back(args[pos++] != 0);
+            } else if (type == ARG_NUMBER) {
+                double value;
+                memcpy(&value, args.data() + pos, sizeof(value));
+                t_store.push_back(value);
+                pos += sizeof(value);
+            } else if (type == ARG_INTEGER) {
+                int64_t value;
+                memcpy(&value, args.data() + pos, sizeof(value));
+                t_store.push_back(value);
+                pos += sizeof(value);
+            } else {
+                uint32_t len;
+                memcpy(&len, args.data() + pos, sizeof(len));
+                vstring value(args.data() + pos + sizeof(len), len);
+                if (vfmt.data() == nullptr) {
+                    vfmt = value;
+                } else {
+                    t_store.push_back(value);
+                }
+                pos += sizeof(len) + len;
+            }
+        }
+        try {
+            log_format::find(vfmt).format(t_buf, t_store);
+        } catch (const std::exception& e) {
+            t_buf.clear();
+            fmt::format_to(std::back_inserter(t_buf), "log format failed: {}! fmt: {}", e.what(), vfmt);
+        }
+        deferred_ = false;
+        assign(vstring(t_buf.data(), t_buf.size()));
+    }
+
+    void log_message::append(const void* data, size_t size) {
+        size_t nsize = size_ + size;
+        if (nsize > MSG_INLINE) {
+            if (size_ <= MSG_INLINE) {
+                overflow_.assign(buff_, size_);
+            }
+            overflow_.append((cpchar)data, size);
+        } else {
+            memcpy(buff_ + size_, data, size);
+        }
+        size_ = nsize;
+    }
+
+    void log_message::assign(vstring msg) {
+        size_ = msg.size();
+        if (size_ <= MSG_INLINE) {
+            memcpy(buff_, msg.data(), size_);
+            //偶发的超长日志不长期占用内存
+            if (overflow_.capacity() > MSG_RETAIN) {
+                sstring().swap(overflow_);
+            }
+            return;
+        }
+        overflow_.assign(msg.data(), size_);
+    }
+
+    // class log_histogram
+    // --------------------------------------------------------------------------------
+    void log_histogram::record(int64_t us) {
+        size_t value = us > 0 ? (size_t)us : 0;
+        size_t bucket = 0;
+        while (bucket + 1 < BUCKETS && value >= ((size_t)1 << bucket)) ++bucket;
+        count_add(count, 1);
+        count_add(sum, value);
+        count_add(buckets[bucket], 1);
+        if (value > max.load(std::memory_order_relaxed)) {
+            max.store(value, std::memory_order_relaxed);
+        }
     }
 
     // class log_message_pool
     // --------------------------------------------------------------------------------
     sptr<log_message> log_message_pool::allocate() {
         if (alloc_msgs_->empty()) {
-            if (free_msgs_->empty()) {
+            {
+                //free_msgs_由日志线程回收，必须加锁访问
+                std::unique_lock<spin_mutex> lock(mutex_);
+                alloc_msgs_.swap(free_msgs_);
                 free_msgs_->reserve(QUEUE_SIZE);
+            }
+            if (alloc_msgs_->empty()) {
+                count_add(refills_, 1);
                 alloc_msgs_->reserve(QUEUE_SIZE);
                 for (size_t i = 0; i < QUEUE_SIZE; ++i) {
                     alloc_msgs_->push_back(std::make_shared<log_message>());
                 }
-            } else {
-                std::unique_lock<spin_mutex> lock(mutex_);
-                alloc_msgs_.swap(free_msgs_);
             }
         }
         if (alloc_msgs_->empty()) {
@@ -53,193 +404,1862 @@ namespace logger {
     void log_message_pool::recycle(sptr<log_messages> logmsgs) {
         std::unique_lock<spin_mutex> lock(mutex_);
         size_t fspace = free_msgs_->capacity() - free_msgs_->size();
-        size_t n = std::min(fspace, logmsgs->size());
-        if (n == 0) return;
-        auto siter = logmsgs->begin();
-        free_msgs_->insert(free_msgs_->end(), std::make_move_iterator(siter), std::make_move_iterator(siter + n));
+        for (auto& logmsg : *logmsgs) {
+            if (fspace == 0) break;
+            //异步阶段仍持有的消息不能复用，use_count是relaxed读取，由held的acquire保证worker已读完
+            if (!logmsg->held() && logmsg.use_count() == 1) {
+                free_msgs_->push_back(std::move(logmsg));
+                --fspace;
+            }
+        }
+    }
+
+    // class log_waker
+    // --------------------------------------------------------------------------------
+    void log_waker::wakeup() {
+        parked_ = false;
+        std::unique_lock<std::mutex> lock(mutex_);
+        condv_.notify_one();
+    }
+
+    void log_waker::notify(log_level level) {
+        if (mode_ == wait_mode::POLL) return;
+        //与wait中的parked_形成Dekker屏障，保证不丢失唤醒
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!parked_.load(std::memory_order_relaxed)) return;
+        //批量延迟模式下，只有ERROR及以上级别立即唤醒
+        if (delay_ > 0 && level < log_level::LOG_LEVEL_ERROR) return;
+        //日志线程挂起时所有队列为空，只有第一个生产者负责唤醒
+        if (parked_.exchange(false)) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            condv_.notify_one();
+        }
+    }
+
+    void log_waker::wait(std::function<bool()> pending) {
+        size_t delay = delay_;
+        if (mode_ == wait_mode::POLL) {
+            std::this_thread::sleep_for(milliseconds(delay > 0 ? delay : 1));
+            return;
+        }
+        if (++spins_ < SPIN_COUNT) {
+            std::this_thread::yield();
+            return;
+        }
+        spins_ = 0;
+        std::unique_lock<std::mutex> lock(mutex_);
+        parked_.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!pending()) {
+            condv_.wait_for(lock, milliseconds(delay > 0 ? delay : PARK_TIME), [this] { return !parked_; });
+        }
+        parked_ = false;
     }
 
     // class log_message_queue
     // --------------------------------------------------------------------------------
-    void log_message_queue::put(sptr<log_message> logmsg) {
-        std::unique_lock<spin_mutex> lock(mutex_);
-        write_msgs_->push_back(std::move(logmsg));
+    sptr<log_messages> log_message_queue::timed_getv() {
+        auto count = ring_.drain([this](sptr<log_message>&& logmsg) {
+            read_msgs_->push_back(std::move(logmsg));
+        });
+        return count > 0 ? read_msgs_ : nullptr;
+    }
+
+    // class log_overflow
+    // --------------------------------------------------------------------------------
+    void log_overflow::update_share() {
+        size_t capacity = capacity_, agents = agents_;
+        share_ = capacity == 0 ? SIZE_MAX : std::max<size_t>(1, capacity / std::max<size_t>(1, agents));
+    }
+
+    std::array<size_t, 7> log_overflow::drops() const {
+        std::array<size_t, 7> drops;
+        for (size_t i = 0; i < drops.size(); ++i) {
+            drops[i] = drops_[i].load(std::memory_order_relaxed);
+        }
+        return drops;
     }
 
-    sptr<log_messages> log_message_queue::timed_getv(bool running) {
-        if (running) {
-            if (write_msgs_->empty()) return nullptr;
-            std::unique_lock<spin_mutex> lock(mutex_, std::try_to_lock);
-            if (lock.owns_lock()) {
-                read_msgs_.swap(write_msgs_);
-                return read_msgs_;
+    sstring log_overflow::summary(bool force) {
+        auto now = steady_clock::now();
+        if (!force && now - last_summary_ < seconds(1)) return "";
+        size_t total = 0;
+        fmt::memory_buffer buf;
+        auto names = level_names<log_level>()();
+        for (size_t i = 0; i < drops_.size(); ++i) {
+            size_t drops = drops_[i].load(std::memory_order_relaxed);
+            if (drops > reported_[i]) {
+                fmt::format_to(std::back_inserter(buf), " {}={}", names[i], drops - reported_[i]);
+                total += drops - reported_[i];
+                reported_[i] = drops;
             }
-            return nullptr;
         }
+        if (total == 0) return "";
+        last_summary_ = now;
+        return fmt::format("log queue overflow, dropped {} messages:{}", total, fmt::to_string(buf));
+    }
+
+    // class limit_rule
+    // --------------------------------------------------------------------------------
+    bool limit_rule::allow() {
+        return allow(duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count());
+    }
+
+    bool limit_rule::allow(int64_t now) {
+        std::unique_lock<spin_mutex> lock(mutex_);
+        if (sample_ > 1 && (seen_++ % sample_) != 0) {
+            suppressed_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        if (rate_ > 0) {
+            if (last_ > 0) {
+                tokens_ = std::min(burst_, tokens_ + (now - last_) * rate_ / 1000000);
+            }
+            last_ = now;
+            if (tokens_ < 1) {
+                suppressed_.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            tokens_ -= 1;
+        }
+        return true;
+    }
+
+    size_t limit_rule::report() {
+        size_t suppressed = suppressed_.load(std::memory_order_relaxed);
+        size_t count = suppressed - reported_;
+        reported_ = suppressed;
+        return count;
+    }
+
+    // class log_limiter
+    // --------------------------------------------------------------------------------
+    sptr<limit_rules> log_limiter::rules() {
+        std::unique_lock<spin_mutex> lock(mutex_);
+        return rules_;
+    }
+
+    void log_limiter::set_limit(limit_type type, cpchar key, double rate, size_t burst, size_t sample) {
         std::unique_lock<spin_mutex> lock(mutex_);
-        read_msgs_.swap(write_msgs_);
-        return read_msgs_;
+        auto rules = std::make_shared<limit_rules>(*rules_);
+        auto& rule_map = (*rules)[(int)type];
+        if (rate <= 0 && sample <= 1) {
+            rule_map.erase(key);
+        } else {
+            //未指定突发容量时允许1秒的量
+            rule_map[key] = std::make_shared<limit_rule>(type, key, rate, burst > 0 ? burst : (size_t)rate, sample);
+        }
+        rules_ = rules;
+        enabled_ = !(*rules)[0].empty() || !(*rules)[1].empty() || !(*rules)[2].empty();
+        has_source_ = !(*rules)[(int)limit_type::SOURCE].empty();
+        version_.fetch_add(1, std::memory_order_release);
+    }
+
+    bool log_limiter::allow(const limit_rules& rules, vstring tag, vstring feature, vstring source, int line) {
+        auto check = [](auto& rule_map, vstring key) {
+            if (rule_map.empty()) return true;
+            auto it = rule_map.find(key);
+            return it == rule_map.end() || it->second->allow();
+        };
+        if (!check(rules[(int)limit_type::TAG], tag) || !check(rules[(int)limit_type::FEATURE], feature)) {
+            return false;
+        }
+        auto& source_rules = rules[(int)limit_type::SOURCE];
+        if (!source_rules.empty()) {
+            thread_local sstring t_key;
+            fmt::format_int line_str(line);
+            t_key.assign(source.data(), source.size());
+            t_key.push_back(':');
+            t_key.append(line_str.data(), line_str.size());
+            return check(source_rules, t_key);
+        }
+        return true;
+    }
+
+    std::vector<std::pair<sptr<limit_rule>, size_t>> log_limiter::summary(bool force) {
+        std::vector<std::pair<sptr<limit_rule>, size_t>> suppressed;
+        auto now = steady_clock::now();
+        if (!enabled() || (!force && now - last_summary_ < seconds(1))) return suppressed;
+        last_summary_ = now;
+        for (auto& rule_map : *rules()) {
+            for (auto& [_, rule] : rule_map) {
+                size_t count = rule->report();
+                if (count > 0) {
+                    suppressed.push_back(std::make_pair(rule, count));
+                }
+            }
+        }
+        return suppressed;
+    }
+
+    // class log_flight
+    // --------------------------------------------------------------------------------
+    void log_flight::set(cpchar feature, size_t capacity, log_level level, log_level trigger) {
+        feature_.store(log_interner::intern(feature).data(), std::memory_order_release);
+        level_ = level;
+        trigger_ = trigger;
+        capacity_ = capacity;
+    }
+
+    // class log_recorder
+    // --------------------------------------------------------------------------------
+    log_recorder::log_recorder(size_t capacity) {
+        capacity_ = IO_ALIGN;
+        while (capacity_ < capacity) capacity_ <<= 1;
+        buf_ = std::make_unique<char[]>(capacity_);
+    }
+
+    void log_recorder::record(record_head head, vstring tag, vstring source, vstring msg) {
+        head.tag_len = (uint16_t)std::min<size_t>(tag.size(), UINT16_MAX);
+        head.source_len = (uint16_t)std::min<size_t>(source.size(), UINT16_MAX);
+        //单条记录最多占一半空间，超长的文本截断，二进制参数无法截断则不记录
+        size_t limit = capacity_ / 2 - sizeof(head) - head.tag_len - head.source_len;
+        if (head.tag_len + head.source_len + sizeof(head) >= capacity_ / 2) return;
+        if (msg.size() > limit) {
+            if (head.deferred) return;
+            msg = msg.substr(0, limit);
+        }
+        head.msg_len = (uint32_t)msg.size();
+        size_t size = sizeof(head) + head.tag_len + head.source_len + head.msg_len;
+        while (tail_ + size - head_ > capacity_) {
+            record_head oldest;
+            get(head_, &oldest, sizeof(oldest));
+            head_ += sizeof(oldest) + oldest.tag_len + oldest.source_len + oldest.msg_len;
+        }
+        put(tail_, &head, sizeof(head));
+        put(tail_ + sizeof(head), tag.data(), head.tag_len);
+        put(tail_ + sizeof(head) + head.tag_len, source.data(), head.source_len);
+        put(tail_ + sizeof(head) + head.tag_len + head.source_len, msg.data(), head.msg_len);
+        tail_ += size;
+    }
+
+    void log_recorder::put(size_t pos, const void* data, size_t size) {
+        size_t offset = pos & (capacity_ - 1);
+        size_t first = std::min(size, capacity_ - offset);
+        memcpy(buf_.get() + offset, data, first);
+        memcpy(buf_.get(), (const char*)data + first, size - first);
+    }
+
+    void log_recorder::get(size_t pos, void* data, size_t size) const {
+        size_t offset = pos & (capacity_ - 1);
+        size_t first = std::min(size, capacity_ - offset);
+        memcpy(data, buf_.get() + offset, first);
+        memcpy((char*)data + first, buf_.get(), size - first);
     }
 
     // class log_dest
     // --------------------------------------------------------------------------------
     void log_dest::write(sptr<log_message> logmsg) {
-        auto logtxt = fmt::format("{}{}{}\n", build_prefix(logmsg), logmsg->msg(), build_suffix(logmsg));
+        sstring logtxt(line_size(logmsg), '\0');
+        logtxt.resize(format_line(logtxt.data(), logmsg) - logtxt.data());
         raw_write(logtxt, logmsg->level());
+        count_write(logtxt.size());
+    }
+
+    dest_stats log_dest::stats() const {
+        dest_stats stats;
+        stats.messages = messages_.load(std::memory_order_relaxed);
+        stats.bytes = bytes_.load(std::memory_order_relaxed);
+        stats.remaps = remaps_.load(std::memory_order_relaxed);
+        stats.rotations = rotations_.load(std::memory_order_relaxed);
+        stats.rotate_us = rotate_us_.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    size_t log_dest::line_size(const sptr<log_message>& logmsg) const {
+        return logmsg->msg().size() + logmsg->tag().size() + logmsg->source().size() + LINE_EXTRA;
+    }
+
+    char* log_dest::format_line(char* out, const sptr<log_message>& logmsg) {
+        out = format_prefix(out, logmsg);
+        auto msg = logmsg->msg();
+        memcpy(out, msg.data(), msg.size());
+        out = format_suffix(out + msg.size(), logmsg);
+        *out++ = '\n';
+        return out;
+    }
+
+    vstring log_dest::format_time(const sptr<log_message>& logmsg) {
+        if (last_time_ != logmsg->time()) {
+            last_time_ = logmsg->time();
+            time_len_ = fmt::format_to_n(time_buf_, sizeof(time_buf_), "{:%Y-%m-%d %H:%M:%S}", logmsg->logtime()).size;
+        }
+        return vstring(time_buf_, time_len_);
     }
 
-    cstring log_dest::build_prefix(sptr<log_message> logmsg) {
+    char* log_dest::format_prefix(char* out, const sptr<log_message>& logmsg) {
         if (!ignore_prefix_) {
-            if (last_time_ != logmsg->time()) {
-                fmt::format_to(time_buf_, "{:%Y-%m-%d %H:%M:%S}", logmsg->logtime());
-            }
             auto names = level_names<log_level>()();
-            return fmt::format("[{}.{:03d}][{}][{}] ", time_buf_, logmsg->get_usec(), logmsg->tag(), names[(int)logmsg->level()]);
+            return fmt::format_to(out, "[{}.{:03d}][{}][{}] ", format_time(logmsg), logmsg->get_usec(), logmsg->tag(), names[(int)logmsg->level()]);
         }
-        return "";
+        return out;
     }
 
-    cstring log_dest::build_suffix(sptr<log_message> logmsg) {
+    char* log_dest::format_suffix(char* out, const sptr<log_message>& logmsg) {
         if (!ignore_suffix_) {
-            return fmt::format("[{}:{}]", logmsg->source(), logmsg->line());
+            return fmt::format_to(out, "[{}:{}]", logmsg->source(), logmsg->line());
         }
-        return "";
+        return out;
     }
 
     // class stdio_dest
     // --------------------------------------------------------------------------------
-    void stdio_dest::write(sptr<log_message> logmsg) {
-        auto logtxt = fmt::format("{}{}{}", build_prefix(logmsg), logmsg->msg(), build_suffix(logmsg));
-        raw_write(logtxt, logmsg->level());
-    }
+    const char COLOR_RESET[] = "\x1b[0m";
+    const size_t COLOR_EXTRA = 16;
 
-    void stdio_dest::raw_write(sstring& msg, log_level lvl) {
+    stdio_dest::stdio_dest() {
 #ifdef WIN32
-        auto colors = level_colors<log_level>()();
-        std::cout << colors[(int)lvl];
-#endif // WIN32
-        std::cout << msg << std::endl;
+        out_colored_ = _isatty(1);
+        err_colored_ = _isatty(2);
+#else
+        out_colored_ = isatty(1);
+        err_colored_ = isatty(2);
+#endif
     }
 
-    // class log_file_base
-    // --------------------------------------------------------------------------------
-    log_file_base::~log_file_base() {
-        unmap_file();
+    void stdio_dest::flush() {
+        if (out_buf_.size() > 0) write_fd(1, out_buf_);
+        if (err_buf_.size() > 0) write_fd(2, err_buf_);
     }
 
-    void log_file_base::raw_write(sstring& msg, log_level lvl) {
-        size_t msize = msg.size();
-        if (size_ + msize > alc_size_) {
-            size_t required_pages = (size_ + msize - alc_size_ + PAGE_SIZE - 1) / PAGE_SIZE;
-            alc_size_ += required_pages * PAGE_SIZE;
-            unmap_file();
-            map_file();
+    void stdio_dest::write(sptr<log_message> logmsg) {
+        log_level lvl = logmsg->level();
+        bool err = stderr_ && lvl >= log_level::LOG_LEVEL_ERROR;
+        auto& buf = err ? err_buf_ : out_buf_;
+        bool colored = err ? err_colored_ : out_colored_;
+        size_t size = buf.size();
+        char* out = begin_line(buf, line_size(logmsg), lvl, colored);
+        end_line(buf, format_line(out, logmsg), colored);
+        count_write(buf.size() - size);
+        if (buf.size() >= STDIO_SIZE) write_fd(err ? 2 : 1, buf);
+    }
+
+    void stdio_dest::raw_write(vstring msg, log_level lvl) {
+        bool err = stderr_ && lvl >= log_level::LOG_LEVEL_ERROR;
+        auto& buf = err ? err_buf_ : out_buf_;
+        bool colored = err ? err_colored_ : out_colored_;
+        char* out = begin_line(buf, msg.size(), lvl, colored);
+        memcpy(out, msg.data(), msg.size());
+        end_line(buf, out + msg.size(), colored);
+        if (buf.size() >= STDIO_SIZE) write_fd(err ? 2 : 1, buf);
+    }
+
+    char* stdio_dest::begin_line(fmt::memory_buffer& buf, size_t size, log_level lvl, bool colored) {
+        size_t offset = buf.size();
+        buf.resize(offset + size + COLOR_EXTRA);
+        char* out = buf.data() + offset;
+        if (colored) {
+            auto color = level_colors<log_level>()()[(int)lvl];
+            size_t len = strlen(color);
+            memcpy(out, color, len);
+            out += len;
         }
-        if (buff_) {
-            memcpy(buff_ + size_, msg.data(), msize);
-            size_ += msize;
+        return out;
+    }
+
+    void stdio_dest::end_line(fmt::memory_buffer& buf, char* out, bool colored) {
+        if (colored) {
+            //颜色在换行前复位
+            bool newline = out > buf.data() && out[-1] == '\n';
+            if (newline) --out;
+            memcpy(out, COLOR_RESET, sizeof(COLOR_RESET) - 1);
+            out += sizeof(COLOR_RESET) - 1;
+            if (newline) *out++ = '\n';
         }
+        buf.resize(out - buf.data());
     }
 
-    void log_file_base::map_file() {
+    //处理部分写入和非阻塞管道，写满时等待可写，出错时丢弃本批
+    void stdio_dest::write_fd(int fd, fmt::memory_buffer& buf) {
+        size_t offset = 0;
+        while (offset < buf.size()) {
 #ifdef WIN32
-        HANDLE hf = CreateFile(file_path_.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
-        if (!hf) return;
-        HANDLE hfm = CreateFileMapping(hf, 0, PAGE_READWRITE, 0, alc_size_, NULL);
-        if (!hfm) return;
-        buff_ = (char*)MapViewOfFile(hfm, FILE_MAP_ALL_ACCESS, 0, 0, 0);
-        CloseHandle(hfm);
-        CloseHandle(hf);
+            int len = _write(fd, buf.data() + offset, (unsigned int)(buf.size() - offset));
 #else
-        FILE* f = fopen(file_path_.c_str(), "wb+");
-        if (!f) return;
-        int fd = fileno(f);
-        ftruncate(fd, alc_size_);
-        buff_ = (char*)mmap(NULL, alc_size_, PROT_WRITE, MAP_SHARED, fileno(f), 0);
-        fclose(f);
-#endif // WIN32
+            ssize_t len = ::write(fd, buf.data() + offset, buf.size() - offset);
+#endif
+            if (len > 0) {
+                offset += len;
+                continue;
+            }
+            if (len < 0 && errno == EINTR) continue;
+#ifndef WIN32
+            if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                pollfd pfd = { fd, POLLOUT, 0 };
+                poll(&pfd, 1, PARK_TIME);
+                continue;
+            }
+#endif
+            break;
+        }
+        buf.clear();
     }
 
-    void log_file_base::unmap_file() {
-#ifdef WIN32
-        if (buff_) UnmapViewOfFile(buff_);
-#else
-        if (buff_) munmap(buff_, alc_size_);
-#endif // WIN32
-        buff_ = nullptr;
+    // class log_stage
+    // --------------------------------------------------------------------------------
+    void log_stage::write(sptr<log_message> logmsg) {
+        //已删除的阶段不再接收日志，路由线程可能还持有旧快照
+        if (closed_) return;
+        int64_t now = duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+        log_level level = logmsg->level();
+        logmsg->hold();
+        stage_item item { std::move(logmsg), now };
+        if (!ring_.push(std::move(item))) {
+            //队列满时等待worker消费
+            stalls_.fetch_add(1, std::memory_order_relaxed);
+            do {
+                waker_->wakeup();
+                std::this_thread::yield();
+            } while (!ring_.push(std::move(item)));
+        }
+        waker_->notify(level);
     }
 
-    bool log_file_base::check_full(size_t size) {
-        return alc_size_ > max_size_;
+    void log_stage::sync() {
+        size_t req = sync_req_.fetch_add(1) + 1;
+        waker_->wakeup();
+        std::unique_lock<std::mutex> lock(sync_mutex_);
+        sync_condv_.wait_for(lock, milliseconds(STAGE_SYNC), [&] { return sync_done_ >= req; });
     }
 
-    bool log_file_base::create(path file_path, sstring file_name, const std::tm& file_time) {
-        unmap_file();
-        size_ = 0;
-        alc_size_ = PAGE_SIZE;
-        file_time_ = file_time;
-        file_path.append(file_name);
-        file_path_ = file_path.string();
-        map_file();
-        return buff_ != nullptr;
+    size_t log_stage::consume() {
+        //请求之前入队的日志在本轮一定会被取出
+        size_t sync_req = sync_req_.load();
+        int64_t first = 0;
+        size_t count = ring_.drain([&](stage_item&& item) {
+            auto logmsg = std::move(item.logmsg);
+            if (first == 0) first = item.time;
+            dest_->write(logmsg);
+            logmsg->release();
+        });
+        if (count > 0) {
+            dest_->flush();
+            int64_t now = duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+            size_t lag = (size_t)(now - first);
+            written_.fetch_add(count, std::memory_order_relaxed);
+            lag_us_.store(lag, std::memory_order_relaxed);
+            if (lag > max_lag_us_.load(std::memory_order_relaxed)) {
+                max_lag_us_.store(lag, std::memory_order_relaxed);
+            }
+        }
+        if (sync_req != sync_done_.load()) {
+            dest_->sync();
+            {
+                std::unique_lock<std::mutex> lock(sync_mutex_);
+                sync_done_ = sync_req;
+            }
+            sync_condv_.notify_all();
+        }
+        return count;
     }
 
-    // class rolling_hourly
+    stage_stats log_stage::lag_stats() const {
+        stage_stats stats;
+        stats.pending = ring_.size();
+        stats.written = written_.load(std::memory_order_relaxed);
+        stats.stalls = stalls_.load(std::memory_order_relaxed);
+        stats.lag_us = lag_us_.load(std::memory_order_relaxed);
+        stats.max_lag_us = max_lag_us_.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    // class log_stage_worker
     // --------------------------------------------------------------------------------
-    bool rolling_hourly::eval(const log_file_base* log_file, const sptr<log_message> logmsg) const {
-        return logmsg->logtime().tm_hour != log_file->file_time().tm_hour;
+    void log_stage_worker::add(sptr<log_stage> stage) {
+        std::unique_lock<spin_mutex> lock(mutex_);
+        stages_.push_back(stage);
     }
 
-    // class rolling_daily
+    void log_stage_worker::start() {
+        running_ = true;
+        std::thread(&log_stage_worker::run, this).swap(thread_);
+    }
+
+    void log_stage_worker::stop() {
+        running_ = false;
+        waker_->wakeup();
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    void log_stage_worker::run() {
+        while (true) {
+            size_t count = 0;
+            bool closed = false;
+            //只在复制阶段列表时加锁，写盘不持有锁
+            {
+                std::unique_lock<spin_mutex> lock(mutex_);
+                snapshot_.assign(stages_.begin(), stages_.end());
+            }
+            for (auto& stage : snapshot_) {
+                count += stage->consume();
+                closed = closed || stage->closed();
+            }
+            snapshot_.clear();
+            if (closed) {
+                //已删除的阶段写完剩余日志后移除
+                std::unique_lock<spin_mutex> lock(mutex_);
+                stages_.erase(std::remove_if(stages_.begin(), stages_.end(), [](auto& stage) {
+                    return stage->closed() && !stage->pending();
+                }), stages_.end());
+            }
+            if (count > 0) continue;
+            if (!running_) break;
+            waker_->wait([this]() {
+                if (!running_) return true;
+                std::unique_lock<spin_mutex> lock(mutex_);
+                for (auto& stage : stages_) {
+                    if (stage->pending()) return true;
+                }
+                return false;
+            });
+        }
+    }
+
+    // class mmap_backend
     // --------------------------------------------------------------------------------
-    bool rolling_daily::eval(const log_file_base* log_file, const sptr<log_message> logmsg) const {
-        return logmsg->logtime().tm_mday != log_file->file_time().tm_mday;
+#ifndef WIN32
+    //去掉文件末尾连续的0后的长度
+    size_t data_size(int fd, size_t size) {
+        char buf[4096];
+        while (size > 0) {
+            size_t len = std::min(size, sizeof(buf));
+            if (pread(fd, buf, len, size - len) != (ssize_t)len) break;
+            size_t n = len;
+            while (n > 0 && buf[n - 1] == '\0') --n;
+            size -= len - n;
+            if (n > 0) break;
+        }
+        return size;
+    }
+#endif // WIN32
+
+    bool mmap_backend::open(const sstring& file_path, size_t& size) {
+        close();
+        size_ = 0;
+        file_path_ = file_path;
+#ifdef WIN32
+        WIN32_FILE_ATTRIBUTE_DATA attr;
+        if (GetFileAttributesEx(file_path_.c_str(), GetFileExInfoStandard, &attr)) {
+            size_ = ((size_t)attr.nFileSizeHigh << 32) | attr.nFileSizeLow;
+        }
+#else
+        fd_ = ::open(file_path_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd_ < 0) return false;
+        struct stat st;
+        if (fstat(fd_, &st) == 0) {
+            //异常退出时文件没有裁剪，末尾是预分配的0，截到最后写入的位置
+            size_ = data_size(fd_, st.st_size);
+            if (size_ < (size_t)st.st_size && ftruncate(fd_, size_) != 0) {}
+        }
+#endif // WIN32
+        //已存在的文件从末尾追加
+        map_file((size_ / PAGE_SIZE + 1) * PAGE_SIZE + chunk_size_);
+#ifdef WIN32
+        while (buff_ && size_ > 0 && buff_[size_ - 1] == '\0') --size_;
+#endif // WIN32
+        size = size_;
+        return buff_ != nullptr;
+    }
+
+    void mmap_backend::close() {
+        unmap_file();
+        //裁剪掉预分配未写入的部分
+#ifdef WIN32
+        if (!file_path_.empty()) {
+            HANDLE hf = CreateFile(file_path_.c_str(), GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+            if (hf != INVALID_HANDLE_VALUE) {
+                LARGE_INTEGER pos;
+                pos.QuadPart = size_;
+                if (SetFilePointerEx(hf, pos, NULL, FILE_BEGIN)) SetEndOfFile(hf);
+                CloseHandle(hf);
+            }
+            file_path_.clear();
+        }
+#else
+        if (fd_ >= 0) {
+            if (ftruncate(fd_, size_) != 0) {}
+            ::close(fd_);
+            fd_ = -1;
+        }
+#endif // WIN32
+        alc_size_ = 0;
+    }
+
+    char* mmap_backend::reserve(size_t size) {
+        if (size_ + size > alc_size_) {
+            size_t chunks = (size_ + size - alc_size_ + chunk_size_ - 1) / chunk_size_;
+            map_file(alc_size_ + chunks * chunk_size_);
+            count_add(remaps_, 1);
+        }
+        return buff_ ? buff_ + size_ : nullptr;
+    }
+
+    void mmap_backend::sync() {
+        if (!buff_) return;
+#ifdef WIN32
+        FlushViewOfFile(buff_, size_);
+#else
+        msync(buff_, size_, MS_SYNC);
+#endif // WIN32
+    }
+
+    void mmap_backend::map_file(size_t alc_size) {
+#ifdef WIN32
+        unmap_file();
+        HANDLE hf = CreateFile(file_path_.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hf == INVALID_HANDLE_VALUE) return;
+        HANDLE hfm = CreateFileMapping(hf, 0, PAGE_READWRITE, (DWORD)((uint64_t)alc_size >> 32), (DWORD)alc_size, NULL);
+        if (hfm) {
+            buff_ = (char*)MapViewOfFile(hfm, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+            CloseHandle(hfm);
+        }
+        CloseHandle(hf);
+#else
+        if (fd_ < 0) return;
+        //预留磁盘空间，文件系统不支持时退化为ftruncate
+#ifdef __linux__
+        if (posix_fallocate(fd_, alc_size_, alc_size - alc_size_) != 0 && ftruncate(fd_, alc_size) != 0) {
+#else
+        if (ftruncate(fd_, alc_size) != 0) {
+#endif // __linux__
+            unmap_file();
+            return;
+        }
+        void* buff = MAP_FAILED;
+#ifdef __linux__
+        if (buff_) {
+            buff = mremap(buff_, alc_size_, alc_size, MREMAP_MAYMOVE);
+        } else {
+            buff = mmap(NULL, alc_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        }
+#else
+        unmap_file();
+        buff = mmap(NULL, alc_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+#endif // __linux__
+        if (buff == MAP_FAILED) {
+            unmap_file();
+            return;
+        }
+        buff_ = (char*)buff;
+#endif // WIN32
+        alc_size_ = alc_size;
+    }
+
+    void mmap_backend::unmap_file() {
+#ifdef WIN32
+        if (buff_) UnmapViewOfFile(buff_);
+#else
+        if (buff_) munmap(buff_, alc_size_);
+#endif // WIN32
+        buff_ = nullptr;
+    }
+
+#ifndef WIN32
+    // class batch_backend
+    // --------------------------------------------------------------------------------
+    batch_backend::batch_backend(std::atomic<size_t>& remaps) : log_backend(remaps) {
+#ifdef LOG_URING
+        setup_ring();
+#endif // LOG_URING
+    }
+
+    batch_backend::~batch_backend() {
+        close();
+#ifdef LOG_URING
+        close_ring();
+#endif // LOG_URING
+        for (auto& buf : buffers_) {
+            free(buf.data);
+        }
+    }
+
+    bool batch_backend::async() const {
+#ifdef LOG_URING
+        return ring_fd_ >= 0;
+#else
+        return false;
+#endif // LOG_URING
+    }
+
+    bool batch_backend::open(const sstring& file_path, size_t& size) {
+        close();
+        fd_ = ::open(file_path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        if (fd_ < 0) return false;
+        struct stat st;
+        offset_ = fstat(fd_, &st) == 0 ? st.st_size : 0;
+        size = offset_;
+        return true;
+    }
+
+    void batch_backend::close() {
+        if (fd_ < 0) return;
+        flush();
+        wait();
+        ::close(fd_);
+        fd_ = -1;
+    }
+
+    char* batch_backend::reserve(size_t size) {
+        if (fd_ < 0) return nullptr;
+        auto* buf = &buffers_[current_ % IO_BUFFERS];
+        if (buf->used > 0 && buf->used + size > buf->capacity) {
+            ++current_;
+        }
+        //没有空闲缓冲区时提交并等待在途写入
+        if (current_ - head_ >= IO_BUFFERS) {
+            submit();
+            wait();
+        }
+        buf = &buffers_[current_ % IO_BUFFERS];
+        if (size > buf->capacity) {
+            free(buf->data);
+            buf->capacity = (std::max(size, chunk_size_) + IO_ALIGN - 1) / IO_ALIGN * IO_ALIGN;
+            buf->data = (char*)aligned_alloc(IO_ALIGN, buf->capacity);
+            count_add(remaps_, 1);
+        }
+        return buf->data + buf->used;
+    }
+
+    void batch_backend::flush() {
+        if (buffers_[current_ % IO_BUFFERS].used > 0) {
+            ++current_;
+        }
+        submit();
+    }
+
+    void batch_backend::sync() {
+        if (fd_ < 0) return;
+        flush();
+        wait();
+        fdatasync(fd_);
+    }
+
+    void batch_backend::submit() {
+        if (submit_ == current_) return;
+        wait();
+        inflight_bytes_ = 0;
+        for (size_t i = submit_; i < current_; ++i) {
+            auto& buf = buffers_[i % IO_BUFFERS];
+            iovs_[i - submit_] = { buf.data, buf.used };
+            inflight_bytes_ += buf.used;
+        }
+        inflight_offset_ = offset_;
+        offset_ += inflight_bytes_;
+        submit_ = current_;
+#ifdef LOG_URING
+        if (ring_fd_ >= 0 && ring_submit()) return;
+#endif // LOG_URING
+        write_all(inflight_offset_);
+        release();
+    }
+
+    void batch_backend::wait() {
+        if (head_ == submit_) return;
+#ifdef LOG_URING
+        //失败或部分写入时整体重写，按偏移写入可以重复
+        if (ring_fd_ >= 0 && ring_wait() != (int)inflight_bytes_) {
+            write_all(inflight_offset_);
+        }
+#endif // LOG_URING
+        release();
+    }
+
+    void batch_backend::release() {
+        for (size_t i = head_; i < submit_; ++i) {
+            buffers_[i % IO_BUFFERS].used = 0;
+        }
+        head_ = submit_;
+    }
+
+    //同步写入在途的缓冲区，处理部分写入
+    void batch_backend::write_all(size_t offset) {
+        std::array<iovec, IO_BUFFERS> iovs = iovs_;
+        iovec* iov = iovs.data();
+        int count = (int)(submit_ - head_);
+        while (count > 0) {
+            ssize_t len = pwritev(fd_, iov, count, offset);
+            if (len < 0) {
+                if (errno == EINTR) continue;
+                return;
+            }
+            offset += len;
+            while (count > 0 && (size_t)len >= iov->iov_len) {
+                len -= iov->iov_len;
+                ++iov;
+                --count;
+            }
+            if (count > 0) {
+                iov->iov_base = (char*)iov->iov_base + len;
+                iov->iov_len -= len;
+            }
+        }
+    }
+
+#ifdef LOG_URING
+    bool batch_backend::setup_ring() {
+        io_uring_params params = {};
+        ring_fd_ = (int)syscall(__NR_io_uring_setup, 4, &params);
+        if (ring_fd_ < 0) return false;
+        sq_len_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_len_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        sqes_len_ = params.sq_entries * sizeof(io_uring_sqe);
+        bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) {
+            sq_len_ = cq_len_ = std::max(sq_len_, cq_len_);
+        }
+        sq_ptr_ = mmap(NULL, sq_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+        cq_ptr_ = single ? sq_ptr_ : mmap(NULL, cq_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+        void* sqes = mmap(NULL, sqes_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+        if (sq_ptr_ == MAP_FAILED || cq_ptr_ == MAP_FAILED || sqes == MAP_FAILED) {
+            if (sqes != MAP_FAILED) sqes_ = (io_uring_sqe*)sqes;
+            close_ring();
+            return false;
+        }
+        char* sq = (char*)sq_ptr_;
+        char* cq = (char*)cq_ptr_;
+        sq_tail_ = (unsigned*)(sq + params.sq_off.tail);
+        sq_mask_ = (unsigned*)(sq + params.sq_off.ring_mask);
+        sq_array_ = (unsigned*)(sq + params.sq_off.array);
+        cq_head_ = (unsigned*)(cq + params.cq_off.head);
+        cq_tail_ = (unsigned*)(cq + params.cq_off.tail);
+        cq_mask_ = (unsigned*)(cq + params.cq_off.ring_mask);
+        cqes_ = (io_uring_cqe*)(cq + params.cq_off.cqes);
+        sqes_ = (io_uring_sqe*)sqes;
+        return true;
+    }
+
+    void batch_backend::close_ring() {
+        if (sqes_) munmap(sqes_, sqes_len_);
+        if (cq_ptr_ && cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_) munmap(cq_ptr_, cq_len_);
+        if (sq_ptr_ && sq_ptr_ != MAP_FAILED) munmap(sq_ptr_, sq_len_);
+        if (ring_fd_ >= 0) ::close(ring_fd_);
+        sq_ptr_ = cq_ptr_ = nullptr;
+        sqes_ = nullptr;
+        ring_fd_ = -1;
+    }
+
+    bool batch_backend::ring_submit() {
+        unsigned tail = *sq_tail_;
+        unsigned index = tail & *sq_mask_;
+        io_uring_sqe* sqe = &sqes_[index];
+        memset(sqe, 0, sizeof(io_uring_sqe));
+        sqe->opcode = IORING_OP_WRITEV;
+        sqe->fd = fd_;
+        sqe->addr = (uint64_t)iovs_.data();
+        sqe->len = (uint32_t)(submit_ - head_);
+        sqe->off = inflight_offset_;
+        sq_array_[index] = index;
+        __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+        if (syscall(__NR_io_uring_enter, ring_fd_, 1, 0, 0, NULL, 0) == 1) {
+            return true;
+        }
+        //提交失败时退回同步写入，不再使用io_uring
+        __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+        close_ring();
+        return false;
+    }
+
+    int batch_backend::ring_wait() {
+        while (true) {
+            unsigned head = *cq_head_;
+            if (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+                int res = cqes_[head & *cq_mask_].res;
+                __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+                return res;
+            }
+            if (syscall(__NR_io_uring_enter, ring_fd_, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR) {
+                return -errno;
+            }
+        }
+    }
+#endif // LOG_URING
+
+    // class log_shm
+    // --------------------------------------------------------------------------------
+    log_shm::~log_shm() {
+        if (slots_) {
+            //正常退出，收集进程读完剩余日志后回收槽位
+            if (index_ < SHM_SLOTS) slots_[index_].owner = -owner_;
+            //没有其他进程使用且日志都已读完时删除，持有文件锁避免与收集进程同时判断
+            if ((collector_ || flock(fd_, LOCK_EX | LOCK_NB) == 0) && idle()) {
+                shm_unlink(name_.c_str());
+            }
+            munmap(slots_, size_);
+        }
+        if (fd_ >= 0) ::close(fd_);
+    }
+
+    //进程启动时间，取/proc/<pid>/stat的第22个字段，不可读时为0
+    uint64_t process_start(int32_t pid) {
+        FILE* fp = fopen(fmt::format("/proc/{}/stat", pid).c_str(), "r");
+        if (!fp) return 0;
+        char buf[1024];
+        size_t len = fread(buf, 1, sizeof(buf) - 1, fp);
+        fclose(fp);
+        buf[len] = 0;
+        //进程名可能包含空格和括号，从最后一个')'开始数字段
+        const char* it = strrchr(buf, ')');
+        if (!it) return 0;
+        for (int field = 2; *it && field < 22; ++it) {
+            if (*it == ' ') ++field;
+        }
+        return strtoull(it, nullptr, 10);
+    }
+
+    int64_t log_shm::make_owner(int32_t pid) {
+        uint64_t start = process_start(pid) & 0x7FFFFFFF;
+        return (int64_t)((start << 32) | (uint32_t)pid);
+    }
+
+    bool log_shm::alive(int64_t owner) {
+        int32_t pid = (int32_t)(owner & 0xFFFFFFFF);
+        if (::kill(pid, 0) != 0 && errno != EPERM) return false;
+        //pid被复用时启动时间不同
+        uint64_t start = (uint64_t)owner >> 32;
+        uint64_t now_start = process_start(pid) & 0x7FFFFFFF;
+        return start == 0 || now_start == 0 || start == now_start;
+    }
+
+    bool log_shm::idle() const {
+        for (size_t i = 0; i < SHM_SLOTS; ++i) {
+            auto& slot = slots_[i];
+            int64_t owner = slot.owner.load();
+            if (owner == 0) continue;
+            if (owner > 0 && alive(owner)) return false;
+            if (slot.head.load() != slot.tail.load()) return false;
+        }
+        return true;
+    }
+
+    bool log_shm::open(cpchar name, size_t ring_size) {
+        ring_size_ = IO_ALIGN;
+        while (ring_size_ < ring_size) ring_size_ <<= 1;
+        size_t size = SHM_SLOTS * (sizeof(shm_slot) + ring_size_);
+        name_ = fmt::format("/{}", name);
+        fd_ = shm_open(name_.c_str(), O_RDWR | O_CREAT, 0600);
+        if (fd_ < 0) return false;
+        //新建的共享内存全为0，即所有槽位空闲，多个进程同时扩展到相同大小没有影响
+        struct stat st;
+        if (fstat(fd_, &st) != 0) return false;
+        //只使用本用户创建的共享内存，防止其他用户预先创建后注入日志
+        if (st.st_uid != ::geteuid()) return false;
+        if ((st.st_mode & 0077) != 0 && fchmod(fd_, 0600) != 0) return false;
+        if (st.st_size == 0 && ftruncate(fd_, size) != 0) return false;
+        if (st.st_size != 0 && (size_t)st.st_size != size) return false;
+        void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (base == MAP_FAILED) return false;
+        size_ = size;
+        slots_ = (shm_slot*)base;
+        rings_ = (char*)base + SHM_SLOTS * sizeof(shm_slot);
+        owner_ = make_owner(::getpid());
+        for (size_t i = 0; i < SHM_SLOTS; ++i) {
+            auto& slot = slots_[i];
+            int64_t owner = slot.owner.load();
+            //空闲槽位，或进程已退出且日志已被读完的槽位
+            bool idle = owner == 0 || ((owner < 0 || !alive(owner)) && slot.head.load() == slot.tail.load());
+            if (idle && slot.owner.compare_exchange_strong(owner, owner_)) {
+                slot.drops = 0;
+                index_ = i;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool log_shm::elect() {
+        if (collector_) return true;
+        auto now = steady_clock::now();
+        if (now - last_elect_ < seconds(1)) return false;
+        last_elect_ = now;
+        //进程退出时内核释放文件锁，其他进程在下次尝试时接替
+        if (flock(fd_, LOCK_EX | LOCK_NB) == 0) {
+            collector_ = true;
+        }
+        return collector_;
+    }
+
+    bool log_shm::publish(const sptr<log_message>& logmsg, const std::atomic<size_t>& hurry) {
+        auto& slot = slots_[index_];
+        vstring tag = logmsg->tag(), feature = logmsg->feature(), source = logmsg->source(), msg = logmsg->msg();
+        shm_record record;
+        record.stamp = logmsg->stamp();
+        record.line = logmsg->line();
+        record.level = (uint8_t)logmsg->level();
+        record.replayed = logmsg->replayed();
+        record.tag_len = (uint16_t)std::min<size_t>(tag.size(), UINT16_MAX);
+        record.feature_len = (uint16_t)std::min<size_t>(feature.size(), UINT16_MAX);
+        record.source_len = (uint16_t)std::min<size_t>(source.size(), UINT16_MAX);
+        //单条最多占环的一半，超长的内容截断
+        size_t fixed = sizeof(record) + record.tag_len + record.feature_len + record.source_len;
+        if (fixed >= ring_size_ / 2) return false;
+        record.msg_len = (uint32_t)std::min(msg.size(), ring_size_ / 2 - fixed);
+        size_t size = fixed + record.msg_len;
+        uint64_t tail = slot.tail.load(std::memory_order_relaxed);
+        for (size_t i = 0; tail + size - slot.head.load(std::memory_order_acquire) > ring_size_; ++i) {
+            //收集进程退出时可能由本进程接替，由调用方改为本地写入
+            if (elect()) return false;
+            if (hurry.load(std::memory_order_relaxed) > 0) {
+                slot.drops.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            if (stalled_ || i >= SHM_WAIT) {
+                stalled_ = true;
+                slot.drops.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            std::this_thread::sleep_for(milliseconds(1));
+        }
+        stalled_ = false;
+        char* data = ring(index_);
+        put(data, tail, &record, sizeof(record));
+        tail += sizeof(record);
+        put(data, tail, tag.data(), record.tag_len);
+        tail += record.tag_len;
+        put(data, tail, feature.data(), record.feature_len);
+        tail += record.feature_len;
+        put(data, tail, source.data(), record.source_len);
+        tail += record.source_len;
+        put(data, tail, msg.data(), record.msg_len);
+        //完整写入后才发布，进程在写入中途崩溃时这条日志不可见
+        slot.tail.store(tail + record.msg_len, std::memory_order_release);
+        return true;
+    }
+
+    void log_shm::collect(log_messages& logmsgs, log_message_pool& pool, size_t limit) {
+        auto now = steady_clock::now();
+        bool check = now - last_check_ >= seconds(1);
+        if (check) last_check_ = now;
+        for (size_t i = 0; i < SHM_SLOTS; ++i) {
+            auto& slot = slots_[i];
+            int64_t owner = slot.owner.load();
+            if (owner == 0) continue;
+            //已退出的进程读完为止，避免回收时遗留
+            bool dead = owner < 0 || (check && owner != owner_ && !alive(owner));
+            uint64_t head = slot.head.load(std::memory_order_relaxed);
+            uint64_t tail = slot.tail.load(std::memory_order_acquire);
+            const char* data = ring(i);
+            size_t count = 0;
+            for (; head < tail && (dead || count < limit); ++count) {
+                shm_record record;
+                get(data, head, &record, sizeof(record));
+                head += sizeof(record);
+                buf_.resize((size_t)record.tag_len + record.feature_len + record.source_len + record.msg_len);
+                get(data, head, buf_.data(), buf_.size());
+                head += buf_.size();
+                vstring fields = buf_;
+                vstring tag = fields.substr(0, record.tag_len);
+                vstring feature = fields.substr(record.tag_len, record.feature_len);
+                vstring source = fields.substr(record.tag_len + record.feature_len, record.source_len);
+                vstring msg = fields.substr(record.tag_len + record.feature_len + record.source_len);
+                auto logmsg = pool.allocate();
+                logmsg->restore((log_level)record.level, record.stamp, msg, tag, feature, source, record.line, record.replayed != 0);
+                logmsgs.push_back(logmsg);
+            }
+            slot.head.store(head, std::memory_order_release);
+            if (dead && slot.owner.compare_exchange_strong(owner, 0)) {
+                size_t drops = slot.drops.exchange(0);
+                if (owner > 0 || drops > 0) {
+                    auto logmsg = pool.allocate();
+                    int32_t pid = (int32_t)(std::abs(owner) & 0xFFFFFFFF);
+                    auto text = fmt::format("log process {} {}, recovered {} logs, dropped {} logs", pid, owner > 0 ? "crashed" : "exited", count, drops);
+                    logmsg->option(log_level::LOG_LEVEL_WARN, text, "", "", "", 0);
+                    logmsgs.push_back(logmsg);
+                }
+            }
+        }
+    }
+
+    bool log_shm::pending() const {
+        if (!collector_) return false;
+        for (size_t i = 0; i < SHM_SLOTS; ++i) {
+            auto& slot = slots_[i];
+            if (slot.head.load(std::memory_order_relaxed) != slot.tail.load(std::memory_order_acquire)) return true;
+        }
+        return false;
+    }
+
+    void log_shm::put(char* ring, uint64_t pos, const void* data, size_t size) {
+        size_t offset = pos & (ring_size_ - 1);
+        size_t first = std::min(size, ring_size_ - offset);
+        memcpy(ring + offset, data, first);
+        memcpy(ring, (const char*)data + first, size - first);
+    }
+
+    void log_shm::get(const char* ring, uint64_t pos, void* data, size_t size) const {
+        size_t offset = pos & (ring_size_ - 1);
+        size_t first = std::min(size, ring_size_ - offset);
+        memcpy(data, ring + offset, first);
+        memcpy((char*)data + first, ring, size - first);
+    }
+#endif // WIN32
+
+    // class log_file_base
+    // --------------------------------------------------------------------------------
+    log_file_base::~log_file_base() {
+        close_file();
+    }
+
+    void log_file_base::flush() {
+        if (!is_open()) return;
+        backend_->flush();
+        size_t sync_ms = sync_ms_.load(std::memory_order_relaxed);
+        if (sync_ms > 0) {
+            auto now = steady_clock::now();
+            if (now - last_sync_ >= milliseconds(sync_ms)) {
+                backend_->sync();
+                last_sync_ = now;
+            }
+        }
+    }
+
+    void log_file_base::sync() {
+        if (is_open()) backend_->sync();
+    }
+
+    void log_file_base::crash_sync() {
+        if (backend_) backend_->crash_sync();
+    }
+
+    void log_file_base::write(sptr<log_message> logmsg) {
+        size_t offset = size_;
+        char* out = reserve(line_size(logmsg));
+        if (out) {
+            size_t size = format_line(out, logmsg) - out;
+            commit(size);
+            count_write(size);
+            if (index_file_) {
+                index(logmsg, offset, size);
+            }
+        }
+    }
+
+    void log_file_base::raw_write(vstring msg, log_level lvl) {
+        char* out = reserve(msg.size());
+        if (out) {
+            memcpy(out, msg.data(), msg.size());
+            commit(msg.size());
+        }
+    }
+
+    void log_file_base::set_chunk_size(size_t chunk_size) {
+        chunk_size_ = std::max(PAGE_SIZE, (chunk_size + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE);
+    }
+
+    void log_file_base::close_file() {
+        close_index();
+        if (backend_) backend_->close();
+    }
+
+    //索引文件头
+    const char INDEX_MAGIC[4] = { 'L', 'I', 'D', 'X' };
+    struct index_header {
+        char magic[4];
+        uint32_t version;
+        uint32_t block;
+        uint32_t entry;
+    };
+
+    void log_file_base::open_index() {
+        block_ = index_block();
+        block_.offset = size_;
+        if (!index_on_) return;
+        index_file_ = fopen(log_index::index_path(file_path_).string().c_str(), "ab");
+        if (index_file_ && fseek(index_file_, 0, SEEK_END) == 0 && ftell(index_file_) == 0) {
+            index_header header = { {}, 1, (uint32_t)INDEX_BLOCK, (uint32_t)sizeof(index_block) };
+            memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+            fwrite(&header, sizeof(header), 1, index_file_);
+            fflush(index_file_);
+        }
+    }
+
+    void log_file_base::close_index() {
+        if (!index_file_) return;
+        if (block_.count > 0) {
+            fwrite(&block_, sizeof(block_), 1, index_file_);
+        }
+        fclose(index_file_);
+        index_file_ = nullptr;
+    }
+
+    //每写满一块追加一项，当前块在关闭文件时写入
+    void log_file_base::index(const sptr<log_message>& logmsg, size_t offset, size_t size) {
+        if (offset >= block_.offset + INDEX_BLOCK && block_.count > 0) {
+            fwrite(&block_, sizeof(block_), 1, index_file_);
+            fflush(index_file_);
+            block_ = index_block();
+            block_.offset = offset;
+        }
+        block_.size = offset + size - block_.offset;
+        block_.min_stamp = std::min(block_.min_stamp, logmsg->stamp());
+        block_.max_stamp = std::max(block_.max_stamp, logmsg->stamp());
+        block_.levels |= 1 << (int)logmsg->level();
+        ++block_.count;
+    }
+
+    bool log_file_base::check_full(size_t size) {
+        return size_ + size > max_size_;
+    }
+
+    bool log_file_base::create(path file_path, sstring file_name, const std::tm& file_time) {
+        close_file();
+        //后端切换在创建文件时进行，保证只在写入线程中替换
+        io_backend type = backend_type_;
+        if (!backend_ || type != current_type_) {
+#ifndef WIN32
+            if (type == io_backend::BATCH) {
+                backend_ = std::make_unique<batch_backend>(remaps_);
+            } else {
+                backend_ = std::make_unique<mmap_backend>(remaps_);
+            }
+#else
+            backend_ = std::make_unique<mmap_backend>(remaps_);
+#endif // WIN32
+            current_type_ = type;
+        }
+        backend_->set_chunk_size(chunk_size_);
+        size_ = 0;
+        file_time_ = file_time;
+        file_path.append(file_name);
+        file_path_ = file_path.string();
+        if (!backend_->open(file_path_, size_)) {
+            return false;
+        }
+        open_index();
+        return true;
+    }
+
+    // class log_index
+    // --------------------------------------------------------------------------------
+    //按行前缀"[%Y-%m-%d %H:%M:%S.mmm][tag][LEVEL] "过滤，没有前缀的行(多行日志的后续行)跟随上一行
+    struct index_filter {
+        int64_t from, to;
+        uint32_t levels;
+        bool matched = true;
+        sstring last_time;
+        int64_t last_sec = 0;
+
+        bool match(vstring line) {
+            if (line.size() < 27 || line[0] != '[' || line[20] != '.' || line[24] != ']') return matched;
+            if (!isdigit((unsigned char)line[21]) || !isdigit((unsigned char)line[22]) || !isdigit((unsigned char)line[23])) return matched;
+            vstring time = line.substr(1, 19);
+            if (time != last_time) {
+                std::tm tm = {};
+                if (sscanf(sstring(time).c_str(), "%d-%d-%d %d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6) {
+                    return matched;
+                }
+                tm.tm_year -= 1900;
+                tm.tm_mon -= 1;
+                tm.tm_isdst = -1;
+                last_sec = mktime(&tm);
+                last_time = time;
+            }
+            int64_t ms = (line[21] - '0') * 100 + (line[22] - '0') * 10 + (line[23] - '0');
+            int64_t stamp = last_sec * 1000000 + ms * 1000;
+            matched = stamp + 999 >= from && stamp <= to;
+            if (matched && levels != 0) {
+                size_t end = line.find("] ", 25);
+                size_t begin = end == vstring::npos ? vstring::npos : line.rfind('[', end);
+                if (begin == vstring::npos) return matched;
+                vstring name = line.substr(begin + 1, end - begin - 1);
+                auto names = level_names<log_level>()();
+                auto it = std::find(names.begin(), names.end(), name);
+                matched = it != names.end() && (levels & (1 << (it - names.begin()))) != 0;
+            }
+            return matched;
+        }
+    };
+
+    std::vector<index_block> log_index::load(const path& file_path) {
+        std::vector<index_block> blocks;
+        std::ifstream ifs(index_path(file_path), std::ios::binary);
+        index_header header;
+        if (!ifs.read((char*)&header, sizeof(header))) return blocks;
+        if (memcmp(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 || header.entry != sizeof(index_block)) return blocks;
+        index_block block;
+        while (ifs.read((char*)&block, sizeof(block))) {
+            blocks.push_back(block);
+        }
+        return blocks;
+    }
+
+    size_t log_index::query_file(const path& file_path, int64_t from, int64_t to, uint32_t levels, const line_fn& fn, bool& stop) {
+        std::ifstream ifs(file_path, std::ios::binary | std::ios::ate);
+        if (!ifs) return 0;
+        uint64_t file_size = ifs.tellg();
+        //正在写入的映射文件末尾有预分配的0，只查询已写入的部分
+        char tail[4096];
+        while (file_size > 0) {
+            size_t len = std::min<uint64_t>(file_size, sizeof(tail));
+            ifs.seekg(file_size - len);
+            if (!ifs.read(tail, len)) break;
+            size_t n = len;
+            while (n > 0 && tail[n - 1] == '\0') --n;
+            file_size -= len - n;
+            if (n > 0) break;
+        }
+        //选出可能匹配的块，相邻的块合并读取
+        //没有索引项的部分(开启索引前已有的内容、崩溃时丢失的当前块、索引之后的部分)整体扫描
+        auto blocks = load(file_path);
+        std::sort(blocks.begin(), blocks.end(), [](auto& a, auto& b) { return a.offset < b.offset; });
+        std::vector<std::pair<uint64_t, uint64_t>> ranges;
+        auto add_range = [&](uint64_t begin, uint64_t end) {
+            //过期的索引项可能重叠，已读过的部分不重复输出
+            if (!ranges.empty()) begin = std::max(begin, ranges.back().second);
+            end = std::min(end, file_size);
+            if (begin >= end) return;
+            if (!ranges.empty() && ranges.back().second == begin) {
+                ranges.back().second = end;
+            } else {
+                ranges.emplace_back(begin, end);
+            }
+        };
+        uint64_t covered = 0;
+        for (auto& block : blocks) {
+            if (block.offset > covered) add_range(covered, block.offset);
+            covered = std::max(covered, block.offset + block.size);
+            if (block.max_stamp < from || block.min_stamp > to) continue;
+            if (levels != 0 && (block.levels & levels) == 0) continue;
+            add_range(block.offset, block.offset + block.size);
+        }
+        add_range(covered, file_size);
+        size_t count = 0;
+        sstring buf, carry;
+        for (auto [begin, end] : ranges) {
+            index_filter filter { from, to, levels };
+            auto emit = [&](vstring line) {
+                if (filter.match(line)) {
+                    ++count;
+                    stop = !fn(line);
+                }
+            };
+            ifs.clear();
+            ifs.seekg(begin);
+            carry.clear();
+            uint64_t pos = begin;
+            while (pos < end && !stop) {
+                buf.resize(std::min<uint64_t>(end - pos, INDEX_BLOCK));
+                ifs.read(buf.data(), buf.size());
+                size_t len = ifs.gcount();
+                if (len == 0) break;
+                pos += len;
+                vstring data(buf.data(), len);
+                size_t start = 0;
+                while (!stop) {
+                    size_t next = data.find('\n', start);
+                    if (next == vstring::npos) {
+                        carry.append(data.substr(start));
+                        break;
+                    }
+                    if (carry.empty()) {
+                        emit(data.substr(start, next - start));
+                    } else {
+                        carry.append(data.substr(start, next - start));
+                        emit(carry);
+                        carry.clear();
+                    }
+                    start = next + 1;
+                }
+            }
+            if (!carry.empty() && !stop) {
+                emit(carry);
+            }
+            if (stop) break;
+        }
+        return count;
+    }
+
+    size_t log_index::query(const path& log_path, int64_t from, int64_t to, uint32_t levels, const line_fn& fn) {
+        std::vector<path> files;
+        std::error_code ec;
+        for (auto& entry : recursive_directory_iterator(log_path, ec)) {
+            if (entry.is_regular_file(ec) && entry.path().extension() == ".log") {
+                files.push_back(entry.path());
+            }
+        }
+        //滚动文件名带创建时间，按文件名即按时间顺序
+        std::sort(files.begin(), files.end());
+        size_t count = 0;
+        bool stop = false;
+        for (auto& file : files) {
+            count += query_file(file, from, to, levels, fn, stop);
+            if (stop) break;
+        }
+        return count;
+    }
+
+    // class rolling_hourly
+    // --------------------------------------------------------------------------------
+    bool rolling_hourly::eval(const log_file_base* log_file, const sptr<log_message> logmsg) const {
+        return logmsg->logtime().tm_hour != log_file->file_time().tm_hour;
+    }
+
+    // class rolling_daily
+    // --------------------------------------------------------------------------------
+    bool rolling_daily::eval(const log_file_base* log_file, const sptr<log_message> logmsg) const {
+        return logmsg->logtime().tm_mday != log_file->file_time().tm_mday;
+    }
+
+    // class log_compressor
+    // --------------------------------------------------------------------------------
+    void log_compressor::option(int level, size_t threads, size_t queue_size) {
+        std::unique_lock<std::mutex> lock(mutex_);
+#ifdef LOG_ZLIB
+        level_ = std::clamp(level, 0, 9);
+#endif
+        threads_num_ = std::max<size_t>(threads, 1);
+        queue_size_ = queue_size > 0 ? queue_size : QUEUE_SIZE;
+    }
+
+    void log_compressor::stop() {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            running_ = false;
+            stopped_ = true;
+        }
+        condv_.notify_all();
+        for (auto& thread : threads_) {
+            if (thread.joinable()) thread.join();
+        }
+        threads_.clear();
+    }
+
+    compress_stats log_compressor::stats() const {
+        compress_stats stats;
+        {
+            std::unique_lock<std::mutex> lock(const_cast<std::mutex&>(mutex_));
+            stats.pending = tasks_.size();
+        }
+        stats.finished = finished_;
+        stats.dropped = dropped_;
+        stats.failed = failed_;
+        stats.bytes_in = bytes_in_;
+        stats.bytes_out = bytes_out_;
+        stats.cost_ms = cost_ms_;
+        return stats;
+    }
+
+    void log_compressor::compress(const path& file_path, compress_done done) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (stopped_ || tasks_.size() >= queue_size_) {
+            ++dropped_;
+            return;
+        }
+        tasks_.push_back({ file_path, done });
+        if (threads_.empty()) {
+            running_ = true;
+            for (size_t i = 0; i < threads_num_; ++i) {
+                threads_.emplace_back(&log_compressor::run, this);
+            }
+        }
+        condv_.notify_one();
+    }
+
+    void log_compressor::run() {
+#ifdef __linux__
+        setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+#endif
+        while (true) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            condv_.wait(lock, [this] { return !running_ || !tasks_.empty(); });
+            if (tasks_.empty()) break;
+            auto task = std::move(tasks_.front());
+            tasks_.pop_front();
+            lock.unlock();
+
+            //排队期间可能已被清理
+            std::error_code ec;
+            if (!exists(task.file_path, ec)) continue;
+            auto start = steady_clock::now();
+            size_t bytes_in = 0, bytes_out = 0;
+            path gz_path = task.file_path;
+            gz_path += ".gz";
+            if (gzip(task.file_path, gz_path, bytes_in, bytes_out)) {
+                ++finished_;
+                bytes_in_ += bytes_in;
+                bytes_out_ += bytes_out;
+                task.done(task.file_path, gz_path);
+            } else {
+                ++failed_;
+            }
+            cost_ms_ += duration_cast<milliseconds>(steady_clock::now() - start).count();
+        }
+    }
+
+    bool log_compressor::gzip(const path& file_path, const path& gz_path, size_t& bytes_in, size_t& bytes_out) {
+#ifdef LOG_ZLIB
+        FILE* fin = fopen(file_path.string().c_str(), "rb");
+        if (!fin) return false;
+        //先写临时文件，完成后再替换，避免留下不完整的压缩文件
+        path tmp_path = gz_path;
+        tmp_path += ".tmp";
+        auto mode = fmt::format("wb{}", level_.load());
+        gzFile fout = gzopen(tmp_path.string().c_str(), mode.c_str());
+        if (!fout) {
+            fclose(fin);
+            return false;
+        }
+        bool ok = true;
+        std::vector<char> buf(PAGE_SIZE * 4);
+        while (size_t n = fread(buf.data(), 1, buf.size(), fin)) {
+            if (gzwrite(fout, buf.data(), (unsigned)n) != (int)n) {
+                ok = false;
+                break;
+            }
+            bytes_in += n;
+        }
+        ok = (gzclose(fout) == Z_OK) && ok && !ferror(fin);
+        fclose(fin);
+        std::error_code ec;
+        if (ok) {
+            rename(tmp_path, gz_path, ec);
+            bytes_out = file_size(gz_path, ec);
+        }
+        if (!ok || ec) {
+            remove(tmp_path, ec);
+            return false;
+        }
+        remove(file_path, ec);
+        return true;
+#else
+        return false;
+#endif // LOG_ZLIB
+    }
+
+    // class log_cleaner
+    // --------------------------------------------------------------------------------
+    static bool is_log_file(const path& file_path) {
+        if (file_path.extension() == ".gz") {
+            return is_log_file(file_path.stem());
+        }
+        return file_path.extension() == ".log" && file_path.stem().has_extension();
+    }
+
+    log_cleaner::~log_cleaner() {
+        //先停止压缩线程，压缩完成的回调仍会投递到本线程
+        compressor_->stop();
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            running_ = false;
+        }
+        condv_.notify_one();
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    void log_cleaner::rotate(const path& log_path, cpchar feature, const path& file_path, const path& prev_path, const clean_policy& policy) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        tasks_.push_back({ log_path, feature, file_path, policy, file_time_type::clock::now(), {}, prev_path });
+        if (!running_ && !thread_.joinable()) {
+            running_ = true;
+            std::thread(&log_cleaner::run, this).swap(thread_);
+        }
+        condv_.notify_one();
+    }
+
+    void log_cleaner::replace(const path& log_path, cpchar feature, const path& file_path, const path& gz_path) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        tasks_.push_back({ log_path, feature, gz_path, {}, file_time_type::clock::now(), file_path });
+        condv_.notify_one();
+    }
+
+    //滚动文件名为"feature-%Y%m%d-%H%M%S.mmm.pPID[-n].log[.gz]"，".p"之前的20个字符为时间
+    sstring log_cleaner::file_feature(const path& file_path) {
+        sstring name = file_path.filename().string();
+        size_t pos = name.rfind(".p");
+        if (pos == sstring::npos || pos < 20 || name[pos - 20] != '-') return "";
+        return name.substr(0, pos - 20);
+    }
+
+    void log_cleaner::run() {
+#ifdef __linux__
+        setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+#endif
+        while (true) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            condv_.wait(lock, [this] { return !running_ || !tasks_.empty(); });
+            if (tasks_.empty()) break;
+            auto task = std::move(tasks_.front());
+            tasks_.pop_front();
+            lock.unlock();
+
+            auto& dest = dests_[std::make_pair(task.log_path.string(), task.feature)];
+            if (task.replace_path.empty()) {
+                rotate(task, dest);
+            } else {
+                replace(task, dest);
+            }
+        }
+    }
+
+    void log_cleaner::rotate(const clean_task& task, clean_dest& dest) {
+        if (!dest.scanned) {
+            scan(task, dest);
+        }
+        //上一个文件已由写入线程关闭，刷新大小和修改时间，并交给压缩线程
+        auto it = dest.files.end();
+        if (!task.prev_path.empty()) {
+            it = std::find_if(dest.files.begin(), dest.files.end(), [&](auto& it) { return it.second.file_path == task.prev_path; });
+        }
+        if (it != dest.files.end()) {
+            auto prev = it->second;
+            dest.files.erase(it);
+            dest.total_size -= prev.size;
+            std::error_code ec;
+            size_t size = file_size(prev.file_path, ec);
+            auto ftime = last_write_time(prev.file_path, ec);
+            if (!ec) {
+                dest.total_size += size;
+                dest.files.insert({ ftime, { prev.file_path, size } });
+                if (compressor_->enable()) {
+                    compressor_->compress(prev.file_path, [this, log_path = task.log_path, feature = task.feature](const path& file_path, const path& gz_path) {
+                        replace(log_path, feature.c_str(), file_path, gz_path);
+                    });
+                }
+            } else {
+                dest.known.erase(prev.file_path);
+            }
+        }
+        //扫描时可能已经收录了后续滚动的文件
+        if (dest.known.insert(task.file_path).second) {
+            dest.last = dest.files.insert({ task.time, { task.file_path, 0 } });
+        } else {
+            dest.last = std::find_if(dest.files.begin(), dest.files.end(), [&](auto& it) { return it.second.file_path == task.file_path; });
+        }
+        clean(dest, task.policy);
+    }
+
+    void log_cleaner::replace(const clean_task& task, clean_dest& dest) {
+        //文件可能已经被清理
+        if (dest.known.erase(task.replace_path) == 0) {
+            std::error_code ec;
+            remove(task.file_path, ec);
+            return;
+        }
+        //索引按未压缩的偏移记录，压缩后失效
+        std::error_code ec;
+        remove(log_index::index_path(task.replace_path), ec);
+        auto it = std::find_if(dest.files.begin(), dest.files.end(), [&](auto& it) { return it.second.file_path == task.replace_path; });
+        if (it != dest.files.end()) {
+            size_t size = file_size(task.file_path, ec);
+            dest.total_size = dest.total_size - it->second.size + size;
+            it->second = { task.file_path, size };
+            dest.known.insert(task.file_path);
+        }
+    }
+
+    void log_cleaner::scan(const clean_task& task, clean_dest& dest) {
+        //只收录本目标滚动前的文件，之后滚动的文件由各自的任务加入，子目录属于其他目标
+        std::error_code ec;
+        for (auto& entry : directory_iterator(task.log_path, ec)) {
+            if (!entry.is_regular_file(ec) || !is_log_file(entry.path())) continue;
+            if (file_feature(entry.path()) != task.feature) continue;
+            auto ftime = entry.last_write_time(ec);
+            if (ec || ftime >= task.time) continue;
+            size_t size = entry.file_size(ec);
+            dest.files.insert({ ftime, { entry.path(), size } });
+            dest.known.insert(entry.path());
+            dest.total_size += size;
+        }
+        dest.scanned = true;
+    }
+
+    void log_cleaner::clean(clean_dest& dest, const clean_policy& policy) {
+        //按时间从旧到新淘汰，当前写入的文件不删除
+        auto now = file_time_type::clock::now();
+        auto it = dest.files.begin();
+        while (it != dest.files.end()) {
+            if (it == dest.last) {
+                ++it;
+                continue;
+            }
+            bool expired = (size_t)duration_cast<seconds>(now - it->first).count() > policy.clean_time;
+            bool over_count = policy.clean_count > 0 && dest.files.size() > policy.clean_count;
+            bool over_size = policy.clean_size > 0 && dest.total_size > policy.clean_size;
+            if (!expired && !over_count && !over_size) break;
+            std::error_code ec;
+            remove(it->second.file_path, ec);
+            remove(log_index::index_path(it->second.file_path), ec);
+            dest.known.erase(it->second.file_path);
+            dest.total_size -= it->second.size;
+            it = dest.files.erase(it);
+        }
     }
 
     // class log_rollingfile
     // --------------------------------------------------------------------------------
     template<class rolling_evaler>
-    log_rollingfile<rolling_evaler>::log_rollingfile(path& log_path, cpchar feature, size_t max_size, size_t clean_time)
-        : log_file_base(max_size), log_path_(log_path), feature_(feature), clean_time_(clean_time){
+    log_rollingfile<rolling_evaler>::log_rollingfile(path& log_path, cpchar feature, size_t max_size, clean_policy policy, sptr<log_cleaner> cleaner)
+        : log_file_base(max_size), log_path_(log_path), feature_(feature), policy_(policy), cleaner_(cleaner) {
     }
 
     template<class rolling_evaler>
     void log_rollingfile<rolling_evaler>::write(sptr<log_message> logmsg) {
-            auto logtxt = fmt::format("{}{}{}\n", build_prefix(logmsg), logmsg->msg(), build_suffix(logmsg));
-            if (buff_ == nullptr || rolling_evaler_.eval(this, logmsg) || check_full(logtxt.size())) {
+            size_t size = line_size(logmsg);
+            if (!this->is_open() || rolling_evaler_.eval(this, logmsg) || check_full(size)) {
+                auto start = steady_clock::now();
+                path prev_path = this->is_open() ? path(file_path_) : path();
                 create_directories(log_path_);
-                try {
-                    for (auto entry : recursive_directory_iterator(log_path_)) {
-                        if (entry.is_directory() || entry.path().extension().string() != ".log") continue;
-                        if (entry.path().stem().has_extension()) {
-                            auto ftime = last_write_time(entry.path());
-                            if ((size_t)duration_cast<seconds>(file_time_type::clock::now() - ftime).count() > clean_time_) {
-                                remove(entry.path());
-                            }
-                        }
-                    }
-                } catch (...) {}
                 create(log_path_, new_log_file_name(logmsg), logmsg->logtime());
-                assert(buff_);
+                assert(this->is_open());
+                //过期清理交给后台线程
+                if (cleaner_) {
+                    cleaner_->rotate(log_path_, feature_.c_str(), file_path_, prev_path, policy_);
+                }
+                count_add(this->rotations_, 1);
+                count_add(this->rotate_us_, duration_cast<microseconds>(steady_clock::now() - start).count());
             }
-            raw_write(logtxt, logmsg->level());
+            log_file_base::write(logmsg);
         }
 
     template<class rolling_evaler>
     sstring log_rollingfile<rolling_evaler>::new_log_file_name(const sptr<log_message> logmsg) {
-        return fmt::format("{}-{:%Y%m%d-%H%M%S}.{:03d}.p{}.log", feature_, logmsg->logtime(), logmsg->get_usec(), ::getpid());
+        auto file_name = fmt::format("{}-{:%Y%m%d-%H%M%S}.{:03d}.p{}", feature_, logmsg->logtime(), logmsg->get_usec(), ::getpid());
+        //同一毫秒内多次滚动时追加序号，避免写入同一个文件
+        std::error_code ec;
+        sstring unique_name = file_name;
+        for (size_t i = 1; exists(log_path_ / (unique_name + ".log"), ec); ++i) {
+            unique_name = fmt::format("{}-{}", file_name, i);
+        }
+        return unique_name + ".log";
+    }
+
+    // class log_jsonfile
+    // --------------------------------------------------------------------------------
+    char* json_copy(char* out, vstring str) {
+        memcpy(out, str.data(), str.size());
+        return out + str.size();
+    }
+
+    char* json_integer(char* out, int64_t value) {
+        fmt::format_int value_str(value);
+        return json_copy(out, vstring(value_str.data(), value_str.size()));
+    }
+
+    char* json_escape_char(char* out, unsigned char c) {
+        static const char hex[] = "0123456789abcdef";
+        *out++ = '\\';
+        switch (c) {
+        case '"': *out++ = '"'; break;
+        case '\\': *out++ = '\\'; break;
+        case '\n': *out++ = 'n'; break;
+        case '\r': *out++ = 'r'; break;
+        case '\t': *out++ = 't'; break;
+        case '\b': *out++ = 'b'; break;
+        case '\f': *out++ = 'f'; break;
+        default:
+            out = json_copy(out, "u00");
+            *out++ = hex[c >> 4];
+            *out++ = hex[c & 0xF];
+            break;
+        }
+        return out;
+    }
+
+    char* json_escape(char* out, vstring str) {
+        const char* it = str.data();
+        const char* end = it + str.size();
+#ifdef LOG_SSE2
+        //每次检查16字节，没有需要转义的字符时整块拷贝
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i slash = _mm_set1_epi8('\\');
+        const __m128i ctrl = _mm_set1_epi8(0x1F);
+        while (end - it >= 16) {
+            __m128i chunk = _mm_loadu_si128((const __m128i*)it);
+            __m128i special = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, slash));
+            special = _mm_or_si128(special, _mm_cmpeq_epi8(_mm_max_epu8(chunk, ctrl), ctrl));
+            _mm_storeu_si128((__m128i*)out, chunk);
+            int mask = _mm_movemask_epi8(special);
+            if (mask == 0) {
+                it += 16;
+                out += 16;
+                continue;
+            }
+#ifdef _MSC_VER
+            unsigned long pos;
+            _BitScanForward(&pos, mask);
+#else
+            int pos = __builtin_ctz(mask);
+#endif
+            it += pos;
+            out = json_escape_char(out + pos, *it++);
+        }
+#endif
+        while (it < end) {
+            unsigned char c = *it++;
+            if (c == '"' || c == '\\' || c < 0x20) {
+                out = json_escape_char(out, c);
+            } else {
+                *out++ = c;
+            }
+        }
+        return out;
+    }
+
+    template<class rolling_evaler>
+    size_t log_jsonfile<rolling_evaler>::line_size(const sptr<log_message>& logmsg) const {
+        size_t size = logmsg->msg().size() + logmsg->tag().size() + logmsg->feature().size() + logmsg->source().size();
+        return size * 6 + JSON_EXTRA;
+    }
+
+    template<class rolling_evaler>
+    char* log_jsonfile<rolling_evaler>::format_line(char* out, const sptr<log_message>& logmsg) {
+        auto names = level_names<log_level>()();
+        out = json_copy(out, "{\"time\":\"");
+        out = json_copy(out, this->format_time(logmsg));
+        //微秒部分取自微秒时间戳，get_usec是毫秒
+        out = json_copy(out, "\",\"usec\":");
+        out = json_integer(out, logmsg->stamp() % 1000000);
+        out = json_copy(out, ",\"level\":\"");
+        out = json_copy(out, names[(int)logmsg->level()]);
+        out = json_copy(out, "\",\"tag\":\"");
+        out = json_escape(out, logmsg->tag());
+        out = json_copy(out, "\",\"feature\":\"");
+        out = json_escape(out, logmsg->feature());
+        out = json_copy(out, "\",\"source\":\"");
+        out = json_escape(out, logmsg->source());
+        out = json_copy(out, "\",\"line\":");
+        out = json_integer(out, logmsg->line());
+        out = json_copy(out, ",\"msg\":\"");
+        out = json_escape(out, logmsg->msg());
+        return json_copy(out, "\"}\n");
     }
 
     // class log_service
     // --------------------------------------------------------------------------------
+    sstring lvl_name(log_level log_lvl) {
+        auto names = level_names<log_level>()();
+        sstring name = names[(int)log_lvl];
+        std::transform(name.begin(), name.end(), name.begin(), [](auto c) { return std::tolower(c); });
+        return name;
+    }
+
+    //关闭并移除异步阶段，阶段写完剩余日志后由worker移除
+    template<class stage_map, class key_type>
+    void close_stage(stage_map& stages, const key_type& key) {
+        auto it = stages.find(key);
+        if (it != stages.end()) {
+            it->second->close();
+            stages.erase(it);
+        }
+    }
 
 
+#ifndef WIN32
+    const int CRASH_SIGNALS[] = { SIGSEGV, SIGBUS, SIGFPE, SIGABRT };
+    static struct sigaction s_crash_actions[4];
+    static std::atomic<log_service*> s_crash_service = nullptr;
+#endif // WIN32
+
     void log_service::option(cpchar log_path, cpchar service, cpchar index) {
         log_path_ = log_path;
         service_ = fmt::format("{}-{}", service, index);
         create_directories(log_path);
         add_dest(service);
-        //启动日志线程
+        //启动日志线程，先置运行标记，避免线程调度前写满队列的日志被当作未启动而丢弃
+        running_ = true;
         std::thread(&log_service::run, this).swap(thread_);
     }
 
@@ -259,34 +2279,36 @@ namespace logger {
             sptr<log_dest> logfile = nullptr;
             path logger_path = build_path(feature);
             if (rolling_type_ == rolling_type::DAYLY) {
-                logfile = std::make_shared<log_dailyrollingfile>(logger_path, feature, max_size_, clean_time_);
+                logfile = std::make_shared<log_dailyrollingfile>(logger_path, feature, max_size_, clean_policy_, cleaner_);
             } else {
-                logfile = std::make_shared<log_hourlyrollingfile>(logger_path, feature, max_size_, clean_time_);
+                logfile = std::make_shared<log_hourlyrollingfile>(logger_path, feature, max_size_, clean_policy_, cleaner_);
             }
+            logfile->set_chunk_size(chunk_size_);
             if (!main_dest_) {
                 main_dest_ = logfile;
-                return true;
+            } else {
+                dest_features_.insert(std::make_pair(feature, logfile));
             }
-            dest_features_.insert(std::make_pair(feature, logfile));
+            publish();
         }
         return true;
     }
 
     bool log_service::add_lvl_dest(log_level log_lvl) {
-        auto names = level_names<log_level>()();
-        sstring feature = names[(int)log_lvl];
-        std::transform(feature.begin(), feature.end(), feature.begin(), [](auto c) { return std::tolower(c); });
+        sstring feature = lvl_name(log_lvl);
         path logger_path = build_path(service_.c_str());
         logger_path.append(feature);
         std::unique_lock<spin_mutex> lock(mutex_);
+        sptr<log_dest> logfile = nullptr;
         if (rolling_type_ == rolling_type::DAYLY) {
-            auto logfile = std::make_shared<log_dailyrollingfile>(logger_path, feature.c_str(), max_size_, clean_time_);
-            dest_lvls_.insert(std::make_pair(log_lvl, logfile));
+            logfile = std::make_shared<log_dailyrollingfile>(logger_path, feature.c_str(), max_size_, clean_policy_, cleaner_);
         }
         else {
-            auto logfile = std::make_shared<log_hourlyrollingfile>(logger_path, feature.c_str(), max_size_, clean_time_);
-            dest_lvls_.insert(std::make_pair(log_lvl, logfile));
+            logfile = std::make_shared<log_hourlyrollingfile>(logger_path, feature.c_str(), max_size_, clean_policy_, cleaner_);
         }
+        logfile->set_chunk_size(chunk_size_);
+        dest_lvls_.insert(std::make_pair(log_lvl, logfile));
+        publish();
         return true;
     }
 
@@ -296,11 +2318,30 @@ namespace logger {
             auto logfile = std::make_shared<log_file_base>(max_size_);
             path logger_path = build_path(service_.c_str());
             create_directories(logger_path);
-            if (!logfile->create(logger_path, fname, log_time::now())) {
+            logfile->set_chunk_size(chunk_size_);
+            if (!logfile->create(logger_path, fname, log_time::localtime(log_time::now().tm_time))) {
                 return false;
             }
             logfile->ignore_prefix(true);
             dest_features_.insert(std::make_pair(feature, logfile));
+            publish();
+        }
+        return true;
+    }
+
+    bool log_service::add_json_dest(cpchar feature) {
+        std::unique_lock<spin_mutex> lock(mutex_);
+        if (dest_features_.find(feature) == dest_features_.end()) {
+            sptr<log_dest> logfile = nullptr;
+            path logger_path = build_path(feature);
+            if (rolling_type_ == rolling_type::DAYLY) {
+                logfile = std::make_shared<log_dailyjsonfile>(logger_path, feature, max_size_, clean_policy_, cleaner_);
+            } else {
+                logfile = std::make_shared<log_hourlyjsonfile>(logger_path, feature, max_size_, clean_policy_, cleaner_);
+            }
+            logfile->set_chunk_size(chunk_size_);
+            dest_features_.insert(std::make_pair(feature, logfile));
+            publish();
         }
         return true;
     }
@@ -308,11 +2349,15 @@ namespace logger {
     void log_service::del_agent(uint32_t tid) {
         std::unique_lock<spin_mutex> lock(mutex_);
         agents_.erase(tid);
+        overflow_->set_agents(agents_.size());
+        publish();
     }
 
     void log_service::add_agent(sptr<log_agent> agent) {
         std::unique_lock<spin_mutex> lock(mutex_);
         agents_.insert(std::make_pair(agent->get_id(), agent));
+        overflow_->set_agents(agents_.size());
+        publish();
     }
 
     void log_service::del_dest(cpchar feature) {
@@ -320,6 +2365,8 @@ namespace logger {
         auto it = dest_features_.find(feature);
         if (it != dest_features_.end()) {
             dest_features_.erase(it);
+            close_stage(stages_, feature);
+            publish();
         }
     }
 
@@ -328,7 +2375,180 @@ namespace logger {
         auto it = dest_lvls_.find(log_lvl);
         if (it != dest_lvls_.end()) {
             dest_lvls_.erase(it);
+            close_stage(lvl_stages_, log_lvl);
+            publish();
+        }
+    }
+
+    bool log_service::set_dest_async(cpchar feature, size_t worker) {
+        std::unique_lock<spin_mutex> lock(mutex_);
+        sptr<log_stage> stage = nullptr;
+        auto it = dest_features_.find(feature);
+        if (strcmp(feature, "stdio") == 0) {
+            stage = make_stage(std_dest_, feature, worker);
+        } else if (it != dest_features_.end()) {
+            stage = make_stage(it->second, feature, worker);
+        } else if (strcmp(feature, "main") == 0) {
+            stage = make_stage(main_dest_, feature, worker);
+        }
+        if (!stage) return false;
+        stages_[feature] = stage;
+        return true;
+    }
+
+    bool log_service::set_lvl_async(log_level log_lvl, size_t worker) {
+        std::unique_lock<spin_mutex> lock(mutex_);
+        auto it = dest_lvls_.find(log_lvl);
+        if (it == dest_lvls_.end()) return false;
+        //等级阶段单独存放，统计中以"level:"区分同名的feature
+        auto name = fmt::format("level:{}", lvl_name(log_lvl));
+        auto stage = make_stage(it->second, name.c_str(), worker);
+        if (!stage) return false;
+        lvl_stages_[log_lvl] = stage;
+        return true;
+    }
+
+    bool log_service::set_shared(cpchar name, size_t ring_size) {
+#ifndef WIN32
+        auto shm = std::make_shared<log_shm>();
+        if (!shm->open(name, ring_size)) return false;
+        std::unique_lock<spin_mutex> lock(mutex_);
+        shm_ = shm;
+        publish();
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    bool log_service::set_flight_recorder(cpchar feature, size_t capacity, log_level level, log_level trigger) {
+        if (capacity > 0) {
+            {
+                //option之前没有主日志，add_dest会把记录目标当作主日志
+                std::unique_lock<spin_mutex> lock(mutex_);
+                if (!main_dest_) return false;
+            }
+            add_dest(feature);
+        }
+        flight_->set(feature, capacity, level, trigger);
+        return true;
+    }
+
+    bool log_service::set_dest_backend(cpchar feature, io_backend backend, size_t sync_ms) {
+        std::unique_lock<spin_mutex> lock(mutex_);
+        auto it = dest_features_.find(feature);
+        if (it != dest_features_.end()) {
+            return set_backend(it->second, backend, sync_ms);
+        }
+        if (strcmp(feature, "main") == 0) {
+            return set_backend(main_dest_, backend, sync_ms);
+        }
+        return false;
+    }
+
+    bool log_service::set_lvl_backend(log_level log_lvl, io_backend backend, size_t sync_ms) {
+        std::unique_lock<spin_mutex> lock(mutex_);
+        auto it = dest_lvls_.find(log_lvl);
+        if (it != dest_lvls_.end()) {
+            return set_backend(it->second, backend, sync_ms);
+        }
+        return false;
+    }
+
+    bool log_service::set_dest_index(cpchar feature, bool on) {
+        std::unique_lock<spin_mutex> lock(mutex_);
+        auto it = dest_features_.find(feature);
+        if (it != dest_features_.end()) {
+            return set_index(it->second, on);
+        }
+        if (strcmp(feature, "main") == 0) {
+            return set_index(main_dest_, on);
         }
+        return false;
+    }
+
+    bool log_service::set_lvl_index(log_level log_lvl, bool on) {
+        std::unique_lock<spin_mutex> lock(mutex_);
+        auto it = dest_lvls_.find(log_lvl);
+        if (it != dest_lvls_.end()) {
+            return set_index(it->second, on);
+        }
+        return false;
+    }
+
+    bool log_service::set_index(sptr<log_dest> dest, bool on) {
+        if (auto stage = std::dynamic_pointer_cast<log_stage>(dest)) {
+            dest = stage->dest();
+        }
+        auto logfile = std::dynamic_pointer_cast<log_file_base>(dest);
+        if (!logfile || !logfile->indexable()) return false;
+        logfile->set_index(on);
+        return true;
+    }
+
+    bool log_service::set_backend(sptr<log_dest> dest, io_backend backend, size_t sync_ms) {
+        if (auto stage = std::dynamic_pointer_cast<log_stage>(dest)) {
+            dest = stage->dest();
+        }
+        auto logfile = std::dynamic_pointer_cast<log_file_base>(dest);
+        if (!logfile) return false;
+        logfile->set_backend(backend, sync_ms);
+        return true;
+    }
+
+    sptr<log_stage> log_service::make_stage(sptr<log_dest>& dest, cpchar name, size_t worker) {
+        if (!dest || std::dynamic_pointer_cast<log_stage>(dest)) {
+            return nullptr;
+        }
+        auto& stage_worker = workers_[worker];
+        if (!stage_worker) {
+            stage_worker = std::make_shared<log_stage_worker>();
+            stage_worker->start();
+        }
+        auto stage = std::make_shared<log_stage>(name, dest, stage_worker->waker(), queue_size_);
+        stage_worker->add(stage);
+        dest = stage;
+        publish();
+        return stage;
+    }
+
+    void log_service::publish() {
+        auto routes = std::make_shared<log_routes>();
+        routes->std_dest = std_dest_;
+        routes->main_dest = main_dest_;
+        for (auto& [level, dest] : dest_lvls_) {
+            routes->lvl_dests[(int)level] = dest;
+        }
+        for (auto& [feature, dest] : dest_features_) {
+            uint32_t id = log_feature::id(log_interner::intern(feature));
+            if (id >= routes->feature_dests.size()) {
+                routes->feature_dests.resize(id + 1);
+            }
+            routes->feature_dests[id] = dest;
+        }
+        for (auto& [_, agent] : agents_) {
+            routes->agents.push_back(agent);
+        }
+#ifndef WIN32
+        routes->shm = shm_;
+#endif
+        std::atomic_store(&routes_, routes);
+        //崩溃处理读取的快照由crash_keep_持有，新指针写入后才释放旧快照
+        auto old_keep = std::move(crash_keep_);
+        crash_keep_ = routes;
+        crash_routes_ = routes.get();
+    }
+
+    std::map<sstring, stage_stats> log_service::get_stage_stats() {
+        std::unique_lock<spin_mutex> lock(mutex_);
+        std::map<sstring, stage_stats> stats;
+        for (auto& [_, stage] : stages_) {
+            stats.emplace(stage->name(), stage->lag_stats());
+        }
+        for (auto& [_, stage] : lvl_stages_) {
+            stats.emplace(stage->name(), stage->lag_stats());
+        }
+        return stats;
     }
 
     void log_service::set_dest_clean_time(cpchar feature, size_t clean_time){
@@ -340,6 +2560,7 @@ namespace logger {
     }
 
     void log_service::ignore_prefix(cpchar feature, bool prefix) {
+        std::unique_lock<spin_mutex> lock(mutex_);
         auto iter = dest_features_.find(feature);
         if (iter != dest_features_.end()) {
             iter->second->ignore_prefix(prefix);
@@ -348,6 +2569,7 @@ namespace logger {
     }
 
     void log_service::ignore_suffix(cpchar feature, bool suffix) {
+        std::unique_lock<spin_mutex> lock(mutex_);
         auto iter = dest_features_.find(feature);
         if (iter != dest_features_.end()) {
             iter->second->ignore_suffix(suffix);
@@ -356,69 +2578,363 @@ namespace logger {
     }
 
     log_service::log_service(){
-        std_dest_ = std::make_shared<stdio_dest>();
+        std_dest_ = stdio_;
+        routes_->std_dest = std_dest_;
     }
 
     log_service::~log_service() {
         auto tid = std::this_thread::get_id();
         running_ = false;
+        waker_->wakeup();
         if (thread_.joinable()) {
             thread_.join();
+            //路由线程退出后再停止异步阶段，保证已投递的日志写完
+            for (auto& [_, worker] : workers_) {
+                worker->stop();
+            }
             agents_.clear();
             dest_lvls_.clear();
             dest_features_.clear();
             main_dest_ = nullptr;
             std_dest_ = nullptr;
+            crash_routes_ = nullptr;
+            crash_keep_ = nullptr;
+            routes_ = nullptr;
         }
+#ifndef WIN32
+        log_service* self = this;
+        s_crash_service.compare_exchange_strong(self, nullptr);
+        if (crash_fd_ >= 0) {
+            ::close(crash_fd_);
+            crash_fd_ = -1;
+        }
+#endif // WIN32
     }
 
-    void log_service::flush() {
-        std::unique_lock<spin_mutex> lock(mutex_);
-        for (auto dest : dest_features_)
-            dest.second->flush();
-        for (auto dest : dest_lvls_)
-            dest.second->flush();
-        if (main_dest_) {
-            main_dest_->flush();
+    void log_service::flush(const log_routes& routes) {
+        if (routes.std_dest) {
+            routes.std_dest->flush();
+        }
+        for (auto& dest : routes.feature_dests) {
+            if (dest) dest->flush();
+        }
+        for (auto& dest : routes.lvl_dests) {
+            if (dest) dest->flush();
+        }
+        if (routes.main_dest) {
+            routes.main_dest->flush();
         }
     }
    
     void log_service::run() {
-        running_ = true;
         std::this_thread::sleep_for(std::chrono::milliseconds(100));
         while (true) {
             bool empty = true;
-            for (auto [_, agent] : agents_) {
-                auto logmsgs = agent->timed_getv(running_);
+            //每轮取一次路由快照，配置变更在下一轮生效
+            auto routes = std::atomic_load(&routes_);
+#ifndef WIN32
+            if (routes->shm) {
+                routes->shm->elect();
+            }
+#endif
+            for (auto& agent : routes->agents) {
+                std::unique_lock<std::mutex> lock(dispatch_mutex_);
+                auto logmsgs = agent->timed_getv();
                 if (logmsgs == nullptr) continue;
+                auto start = steady_clock::now();
                 for (auto logmsg : *logmsgs) {
-                    if (!log_daemon_) {
-                        std_dest_->write(logmsg);
-                    }
-                    main_dest_->write(logmsg);
-                    auto it_lvl = dest_lvls_.find(logmsg->level());
-                    if (it_lvl != dest_lvls_.end()) {
-                        it_lvl->second->write(logmsg);
-                    }
-                    auto it_fea = dest_features_.find(logmsg->feature());
-                    if (it_fea != dest_features_.end()) {
-                        it_fea->second->write(logmsg);
-                    }
+                    dispatch(*routes, logmsg);
                 }
+                flush(*routes);
+                //一批日志共用一次时钟读取统计延迟
+                auto now = duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+                for (auto& logmsg : *logmsgs) {
+                    latency_.record(now - logmsg->stamp());
+                }
+                loop_.record(duration_cast<microseconds>(steady_clock::now() - start).count());
                 empty = false;
                 agent->recycle(logmsgs);
                 logmsgs->clear();
-                flush();
             }
+            std::unique_lock<std::mutex> lock(dispatch_mutex_);
+            if (collect(*routes)) {
+                empty = false;
+            }
+            report(*routes, !running_ && empty);
+            if (empty) {
+                //压力解除后输出丢弃汇总
+                auto summary = overflow_->summary(!running_);
+                if (!summary.empty()) {
+                    auto logmsg = std::make_shared<log_message>();
+                    logmsg->option(log_level::LOG_LEVEL_WARN, summary, "", "", "", 0);
+                    dispatch(*routes, logmsg);
+                    flush(*routes);
+                }
+            }
+            lock.unlock();
             if (!running_ && empty) {
                 break;
             }
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            if (empty) {
+                waker_->wait([this]() {
+                    if (!running_) return true;
+                    auto routes = std::atomic_load(&routes_);
+                    for (auto& agent : routes->agents) {
+                        if (agent->pending()) return true;
+                    }
+#ifndef WIN32
+                    if (routes->shm && routes->shm->pending()) return true;
+#endif
+                    return false;
+                });
+            }
+        }
+    }
+
+    //收集其他进程经共享内存转交的日志，返回是否有日志
+    bool log_service::collect(const log_routes& routes) {
+#ifndef WIN32
+        if (!routes.shm || !routes.shm->elect()) return false;
+        routes.shm->collect(*shm_msgs_, *shm_pool_, QUEUE_SIZE);
+        if (shm_msgs_->empty()) return false;
+        for (auto& logmsg : *shm_msgs_) {
+            dispatch(routes, logmsg);
+        }
+        flush(routes);
+        auto now = duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+        for (auto& logmsg : *shm_msgs_) {
+            latency_.record(now - logmsg->stamp());
+        }
+        shm_pool_->recycle(shm_msgs_);
+        shm_msgs_->clear();
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    histogram_stats read_histogram(const log_histogram& histogram) {
+        histogram_stats stats;
+        stats.count = histogram.count.load(std::memory_order_relaxed);
+        stats.sum = histogram.sum.load(std::memory_order_relaxed);
+        stats.max = histogram.max.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < log_histogram::BUCKETS; ++i) {
+            stats.buckets[i] = histogram.buckets[i].load(std::memory_order_relaxed);
+        }
+        return stats;
+    }
+
+    log_stats log_service::get_stats() {
+        log_stats stats;
+        std::unique_lock<spin_mutex> lock(mutex_);
+        for (auto& [id, agent] : agents_) {
+            stats.agents.emplace((uint32_t)id, agent->stats());
+        }
+        if (std_dest_) stats.dests.emplace("stdio", std_dest_->stats());
+        if (main_dest_) stats.dests.emplace("main", main_dest_->stats());
+        for (auto& [level, dest] : dest_lvls_) {
+            stats.dests.emplace(lvl_name(level), dest->stats());
+        }
+        for (auto& [feature, dest] : dest_features_) {
+            stats.dests.emplace(feature, dest->stats());
+        }
+        lock.unlock();
+        stats.latency = read_histogram(latency_);
+        stats.loop = read_histogram(loop_);
+        stats.drops = overflow_->drops();
+        return stats;
+    }
+
+    //输出限流汇总，保证被抑制的日志有记录
+    void log_service::report(const log_routes& routes, bool force) {
+        for (auto& [rule, count] : limiter_->summary(force)) {
+            auto logmsg = std::make_shared<log_message>();
+            auto msg = fmt::format("log limited by rule {}, suppressed {} messages", rule->key(), count);
+            switch (rule->type()) {
+            case limit_type::TAG: logmsg->option(log_level::LOG_LEVEL_WARN, msg, rule->key().c_str(), "", "", 0); break;
+            case limit_type::FEATURE: logmsg->option(log_level::LOG_LEVEL_WARN, msg, "", rule->key().c_str(), "", 0); break;
+            default: logmsg->option(log_level::LOG_LEVEL_WARN, msg, "", "", "", 0); break;
+            }
+            dispatch(routes, logmsg);
+        }
+    }
+
+    void log_service::dispatch(const log_routes& routes, sptr<log_message> logmsg) {
+        if (logmsg->deferred()) {
+            logmsg->resolve();
+        }
+        uint32_t feature_id = logmsg->feature_id();
+#ifndef WIN32
+        if (routes.shm && !routes.shm->collector()) {
+            //共享模式下由收集进程写文件，本进程只输出控制台，等待中接替为收集进程时改为本地写入
+            bool published = routes.shm->publish(logmsg, sync_waiters_);
+            if (published || !routes.shm->collector()) {
+                if (!published) {
+                    overflow_->drop(logmsg->level());
+                }
+                if (!log_daemon_ && !logmsg->replayed()) {
+                    routes.std_dest->write(logmsg);
+                }
+                return;
+            }
+        }
+#endif
+        if (logmsg->replayed()) {
+            //飞行记录只写入记录目标
+            if (feature_id < routes.feature_dests.size() && routes.feature_dests[feature_id]) {
+                routes.feature_dests[feature_id]->write(logmsg);
+            }
+            return;
+        }
+        if (!log_daemon_) {
+            routes.std_dest->write(logmsg);
+        }
+        routes.main_dest->write(logmsg);
+        auto& lvl_dest = routes.lvl_dests[(int)logmsg->level()];
+        if (lvl_dest) {
+            lvl_dest->write(logmsg);
+        }
+        if (feature_id < routes.feature_dests.size() && routes.feature_dests[feature_id]) {
+            routes.feature_dests[feature_id]->write(logmsg);
+        }
+    }
+
+    void log_service::write_sync(log_agent* agent, sptr<log_message> logmsg) {
+        auto routes = std::atomic_load(&routes_);
+        //让持有锁的日志线程不再等待共享内存，本次写入同样不等待
+        sync_waiters_.fetch_add(1, std::memory_order_relaxed);
+        std::unique_lock<std::mutex> lock(dispatch_mutex_);
+        auto logmsgs = agent->timed_getv();
+        if (logmsgs) {
+            for (auto& pending : *logmsgs) {
+                dispatch(*routes, pending);
+            }
+            agent->recycle(logmsgs);
+            logmsgs->clear();
+        }
+        dispatch(*routes, logmsg);
+        flush(*routes);
+        if (routes->main_dest) routes->main_dest->sync();
+        if (auto& lvl_dest = routes->lvl_dests[(int)logmsg->level()]) lvl_dest->sync();
+        uint32_t feature_id = logmsg->feature_id();
+        if (feature_id < routes->feature_dests.size() && routes->feature_dests[feature_id]) {
+            routes->feature_dests[feature_id]->sync();
+        }
+        sync_waiters_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    bool log_service::install_crash_handler() {
+#ifdef WIN32
+        return false;
+#else
+        if (crash_fd_ < 0) {
+            path crash_path = build_path(service_.c_str());
+            create_directories(crash_path);
+            crash_path.append(fmt::format("{}.crash.log", service_));
+            crash_fd_ = ::open(crash_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            if (crash_fd_ < 0) return false;
+            crash_buf_ = std::make_unique<char[]>(CRASH_SIZE);
+        }
+        //备用栈只对调用线程生效，栈溢出的SIGSEGV也能进入处理函数
+        if (!crash_stack_) {
+            crash_stack_ = std::make_unique<char[]>(CRASH_STACK);
+            stack_t stack = {};
+            stack.ss_sp = crash_stack_.get();
+            stack.ss_size = CRASH_STACK;
+            sigaltstack(&stack, nullptr);
+        }
+        s_crash_service = this;
+        struct sigaction action = {};
+        action.sa_handler = &log_service::on_crash;
+        action.sa_flags = SA_ONSTACK;
+        sigemptyset(&action.sa_mask);
+        for (size_t i = 0; i < std::size(CRASH_SIGNALS); ++i) {
+            sigaction(CRASH_SIGNALS[i], &action, &s_crash_actions[i]);
+        }
+        return true;
+#endif // WIN32
+    }
+
+    void log_service::on_crash(int sig) {
+#ifndef WIN32
+        //只导出一次，其他线程同时崩溃时直接交给原处理函数
+        static std::atomic_flag s_crashed = ATOMIC_FLAG_INIT;
+        auto service = s_crash_service.load();
+        if (service && !s_crashed.test_and_set()) {
+            service->crash_dump(sig);
+        }
+        for (size_t i = 0; i < std::size(CRASH_SIGNALS); ++i) {
+            if (CRASH_SIGNALS[i] == sig) {
+                sigaction(sig, &s_crash_actions[i], nullptr);
+            }
+        }
+        raise(sig);
+#endif // WIN32
+    }
+
+    //信号处理中调用：不分配内存、不加锁，只读遍历各队列中未写入的日志
+    //写入预分配的崩溃缓冲区后，只对mmap映射区域做msync，不调用可能与写入线程冲突的sync
+    void log_service::crash_dump(int sig) {
+        auto routes = crash_routes_.load();
+        if (!routes || !crash_buf_) return;
+        fmt::format_int sig_str(sig);
+        crash_write("crash by signal ");
+        crash_write(vstring(sig_str.data(), sig_str.size()));
+        crash_write(", pending logs:\n");
+        auto names = level_names<log_level>()();
+        for (auto& agent : routes->agents) {
+            agent->peek([&](const sptr<log_message>& logmsg) {
+                fmt::format_int stamp(logmsg->stamp());
+                fmt::format_int line(logmsg->line());
+                crash_write("[");
+                crash_write(vstring(stamp.data(), stamp.size()));
+                crash_write("][");
+                crash_write(logmsg->tag());
+                crash_write("][");
+                crash_write(names[(int)logmsg->level()]);
+                crash_write("] ");
+                //延迟格式化的日志只输出格式串
+                crash_write(logmsg->deferred() ? logmsg->vfmt() : logmsg->msg());
+                crash_write("[");
+                crash_write(logmsg->source());
+                crash_write(":");
+                crash_write(vstring(line.data(), line.size()));
+                crash_write("]\n");
+            });
+        }
+        crash_write("", true);
+#ifndef WIN32
+        fsync(crash_fd_);
+#endif // WIN32
+        if (routes->main_dest) routes->main_dest->crash_sync();
+        for (auto& dest : routes->lvl_dests) {
+            if (dest) dest->crash_sync();
+        }
+        for (auto& dest : routes->feature_dests) {
+            if (dest) dest->crash_sync();
+        }
+    }
+
+    //写入预分配的崩溃缓冲区，缓冲区满或flush时写出到崩溃文件
+    void log_service::crash_write(vstring data, bool flush) {
+        while (true) {
+            size_t len = std::min(data.size(), CRASH_SIZE - crash_size_);
+            if (len > 0) {
+                memcpy(crash_buf_.get() + crash_size_, data.data(), len);
+                crash_size_ += len;
+                data.remove_prefix(len);
+            }
+            if (crash_size_ < CRASH_SIZE && !(flush && data.empty())) return;
+#ifndef WIN32
+            if (::write(crash_fd_, crash_buf_.get(), crash_size_) < 0) {}
+#endif // WIN32
+            crash_size_ = 0;
+            if (data.empty()) return;
         }
     }
 
     log_agent::log_agent() {
-        logmsgque_ = std::make_shared<log_message_queue>();
+        logmsgque_ = std::make_shared<log_message_queue>(QUEUE_SIZE);
         message_pool_ = std::make_shared<log_message_pool>();
     }
 
@@ -433,15 +2949,157 @@ namespace logger {
         service_ = service;
         auto lservice = service_.lock();
         if (lservice) {
+            //按服务配置重建队列，未消费的日志迁移到新队列
+            if (lservice->queue_size() != logmsgque_->capacity()) {
+                auto logmsgque = std::make_shared<log_message_queue>(lservice->queue_size());
+                auto logmsgs = logmsgque_->timed_getv();
+                if (logmsgs) {
+                    for (auto logmsg : *logmsgs) logmsgque->put(logmsg);
+                    logmsgs->clear();
+                }
+                logmsgque_ = logmsgque;
+            }
+            waker_ = lservice->waker();
+            overflow_ = lservice->overflow();
+            limiter_ = lservice->limiter();
+            flight_ = lservice->flight();
             lservice->add_agent(shared_from_this());
         }
     }
 
-    void log_agent::output(log_level level, sstring&& msg, cpchar tag, cpchar feature, cpchar source, int line) {
-        if (!is_filter(level)) {
-            auto logmsg_ = message_pool_->allocate();
-            logmsg_->option(level, std::move(msg), tag, feature, source, line);
-            logmsgque_->put(logmsg_);
+    void log_agent::output(log_level level, vstring msg, cpchar tag, cpchar feature, cpchar source, int line) {
+        if (is_filter(level)) {
+            //被过滤的日志只写入飞行记录
+            if (recording(level)) record(level, msg, tag, source, line);
+            return;
+        }
+        if (limiting() && limited(tag, feature, source, line)) return;
+        commit(level, msg, tag, feature, source, line);
+    }
+
+    void log_agent::commit(log_level level, vstring msg, cpchar tag, cpchar feature, cpchar source, int line) {
+        auto logmsg_ = message_pool_->allocate();
+        logmsg_->option(level, msg, tag, feature, source, line);
+        push(logmsg_);
+    }
+
+    agent_stats log_agent::stats() const {
+        agent_stats stats;
+        stats.depth = logmsgque_->size();
+        stats.capacity = logmsgque_->capacity();
+        stats.messages = messages_.load(std::memory_order_relaxed);
+        stats.refills = message_pool_->refills();
+        return stats;
+    }
+
+    bool log_agent::limited(vstring tag, vstring feature, vstring source, int line) {
+        //规则变化时更新快照
+        size_t version = limiter_->version();
+        if (version != limit_version_ || !limit_rules_) {
+            limit_rules_ = limiter_->rules();
+            limit_version_ = version;
+        }
+        return !log_limiter::allow(*limit_rules_, tag, feature, source, line);
+    }
+
+    log_recorder* log_agent::recorder() {
+        //容量变化时重建，丢弃已有记录
+        size_t capacity = flight_->capacity();
+        if (!recorder_ || capacity != record_capacity_) {
+            recorder_ = std::make_unique<log_recorder>(capacity);
+            record_capacity_ = capacity;
+        }
+        return recorder_.get();
+    }
+
+    void log_agent::record(log_level level, vstring msg, cpchar tag, cpchar source, int line) {
+        log_recorder::record_head head;
+        head.stamp = log_time::now().tm_stamp;
+        head.level = level;
+        head.line = line;
+        recorder()->record(head, tag, source, msg);
+    }
+
+    void log_agent::record(const log_message& logmsg) {
+        log_recorder::record_head head;
+        head.stamp = logmsg.stamp();
+        head.level = logmsg.level();
+        head.line = logmsg.line();
+        head.deferred = logmsg.deferred();
+        if (head.deferred) {
+            head.vfmt = logmsg.vfmt().data();
+            head.vfmt_len = (uint32_t)logmsg.vfmt().size();
+        }
+        recorder()->record(head, logmsg.tag(), logmsg.source(), logmsg.msg());
+    }
+
+    //回放本线程的飞行记录，先于触发的日志入队
+    void log_agent::replay() {
+        if (!recorder_ || recorder_->empty()) return;
+        cpchar feature = flight_->feature();
+        recorder_->replay([&](const log_recorder::record_head& head, vstring tag, vstring source, vstring msg) {
+            auto logmsg = message_pool_->allocate();
+            logmsg->replay(head.level, head.stamp, msg, tag, source, head.line, feature, head.deferred, vstring(head.vfmt, head.vfmt_len));
+            push(logmsg);
+        });
+    }
+
+    void log_agent::push(sptr<log_message> logmsg) {
+        log_level level = logmsg->level();
+        if (flight_ && flight_->enabled() && !logmsg->replayed()) {
+            if (level <= flight_->level()) {
+                record(*logmsg);
+            } else if (level >= flight_->trigger()) {
+                replay();
+            }
+        }
+        if (overflow_ && level >= overflow_->sync_level()) {
+            //高级别日志绕过队列同步写入，避免崩溃前丢失
+            auto service = service_.lock();
+            if (service && service->is_running()) {
+                count_add(messages_, 1);
+                service->write_sync(this, logmsg);
+                return;
+            }
+        }
+        bool limited = overflow_ && logmsgque_->size() >= overflow_->share();
+        if (limited || !logmsgque_->put(logmsg)) {
+            if (!overflow(logmsg)) return;
+        }
+        count_add(messages_, 1);
+        if (waker_) {
+            waker_->notify(level);
+        }
+    }
+
+    //队列满时按溢出策略处理，返回false表示丢弃当前日志
+    bool log_agent::overflow(sptr<log_message>& logmsg) {
+        auto policy = overflow_ ? overflow_->policy() : overflow_policy::BLOCK;
+        if (policy == overflow_policy::DROP_NEWEST || (policy == overflow_policy::DROP_LEVEL && logmsg->level() < overflow_->level())) {
+            overflow_->drop(logmsg->level());
+            return false;
+        }
+        if (waker_) {
+            waker_->wakeup();
+        }
+        size_t limit = overflow_ ? std::min(overflow_->share(), logmsgque_->capacity()) : logmsgque_->capacity();
+        while (true) {
+            size_t size = logmsgque_->size();
+            if (size < limit && logmsgque_->put(logmsg)) {
+                return true;
+            }
+            sptr<log_message> oldest;
+            if (policy == overflow_policy::DROP_OLDEST && size >= limit && logmsgque_->steal(oldest)) {
+                overflow_->drop(oldest->level());
+                continue;
+            }
+            //等待日志线程消费，日志线程未运行则丢弃
+            auto service = service_.lock();
+            if (!service || !service->is_running()) {
+                if (overflow_) overflow_->drop(logmsg->level());
+                return false;
+            }
+            std::this_thread::yield();
         }
     }
 
@@ -1,24 +1,59 @@
 #pragma once
 
 #include <array>
+#include <atomic>
+#include <memory>
 #include <ctime>
+#include <set>
+#include <deque>
 #include <vector>
+#include <unordered_map>
+#include <unordered_set>
 #include <chrono>
 #include <thread>
+#include <functional>
+#include <condition_variable>
 #include <fstream>
 #include <iostream>
 #include <filesystem>
 #include <assert.h>
 
+#include "fmt/args.h"
 #include "fmt/chrono.h"
 #include "lua_kit.h"
 
+#if !defined(LOG_NO_ZLIB) && __has_include(<zlib.h>)
+#include <zlib.h>
+#define LOG_ZLIB
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#define LOG_SSE2
+#endif
+
 #ifdef WIN32
 #define NOMINMAX
 #define getpid _getpid
+#include <io.h>
 #else
+#include <poll.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <unistd.h>
+#include <sys/file.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#if defined(__linux__) && !defined(LOG_NO_URING) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define LOG_URING
+#endif
 #endif
 
 using namespace luakit;
@@ -50,10 +85,54 @@ namespace logger {
         DAYLY = 1,
     }; //rolling_type
 
-    const size_t QUEUE_SIZE = 3000;
+    enum class wait_mode {
+        POLL = 0,       //固定间隔轮询
+        ADAPTIVE = 1,   //自旋后挂起，由生产者唤醒
+    }; //wait_mode
+
+    enum class overflow_policy {
+        BLOCK = 0,          //等待日志线程消费
+        DROP_NEWEST = 1,    //丢弃新日志
+        DROP_OLDEST = 2,    //丢弃队列中最旧的日志
+        DROP_LEVEL = 3,     //丢弃低于阈值级别的新日志，其余等待
+    }; //overflow_policy
+
+    enum class limit_type {
+        TAG = 0,        //按tag限流
+        FEATURE = 1,    //按feature限流
+        SOURCE = 2,     //按"source:line"限流
+    }; //limit_type
+
+    enum class io_backend {
+        MMAP = 0,       //映射文件直接写入
+        BATCH = 1,      //对齐缓冲区批量写入，优先io_uring异步提交，不支持时用pwritev
+    }; //io_backend
+
+    const size_t QUEUE_SIZE = 4096;
+    const size_t CACHE_LINE = 64;
+    const size_t SPIN_COUNT = 64;
+    const size_t PARK_TIME  = 100;
+    const size_t MSG_INLINE = 256;
+    const size_t MSG_RETAIN = 65536;
+    const size_t LINE_EXTRA = 64;
+    const size_t JSON_EXTRA = 192;
+    const size_t FMT_INTERN = 4096;
+    const size_t NAME_INTERN = 16384;
     const size_t PAGE_SIZE  = 65536;
+    const size_t CHUNK_SIZE = 1024 * 1024;
     const size_t MAX_SIZE   = 1024 * 1024 * 16;
     const size_t CLEAN_TIME = 7 * 24 * 3600;
+    const size_t STDIO_SIZE = 65536;
+    const size_t CRASH_SIZE = 65536;
+    const size_t CRASH_STACK = 65536;
+    const size_t IO_ALIGN   = 4096;
+    const size_t IO_BUFFERS = 4;
+    const size_t RECORD_SIZE = 65536;
+    const size_t SHM_SLOTS  = 64;
+    const size_t SHM_RING   = 1024 * 1024;
+    const size_t SHM_WAIT   = 1000;
+    const size_t STAGE_SYNC = 1000;
+    const size_t INDEX_BLOCK = 65536;
 
     template <typename T>
     struct level_names {};
@@ -71,100 +150,778 @@ namespace logger {
         }
     };
 
-    class log_time : public std::tm {
+    class log_time {
     public:
         static log_time now();
-        log_time(const std::tm& tm, time_t sec, int usec) : std::tm(tm), tm_time(sec), tm_usec(usec) { }
+        //按秒缓存的本地时间，每个线程独立缓存
+        static const std::tm& localtime(time_t time);
+        log_time(time_t sec, int usec, int64_t stamp = 0) : tm_usec(usec), tm_time(sec), tm_stamp(stamp) { }
         log_time() { }
 
         int tm_usec = 0;
         time_t tm_time = 0;
+        int64_t tm_stamp = 0;   //微秒时间戳，用于统计延迟
     }; // class log_time
 
+    //tag/feature/source和格式串分表驻留，返回进程内稳定的视图
+    class log_interner {
+    public:
+        //limit非0时驻留数量达到上限后不再驻留新字符串，返回空视图
+        static vstring intern(vstring str, size_t limit = 0);
+        //格式串单独计数，上限为FMT_INTERN
+        static vstring intern_format(vstring vfmt);
+    }; // class log_interner
+
+    //feature编号，注册目标和生成日志时分配，路由按编号查表，0为空feature
+    class log_feature {
+    public:
+        //feature必须是驻留后的字符串
+        static uint32_t id(vstring feature);
+    }; // class log_feature
+
+    //预解析的格式串，切分为字面量和参数字段，按格式串缓存
+    class log_format {
+    public:
+        using format_args = fmt::basic_format_args<fmt::format_context>;
+        static const log_format& find(vstring vfmt);
+        void parse(vstring vfmt);
+        void format(fmt::memory_buffer& buf, const format_args& args) const;
+
+    private:
+        struct piece {
+            vstring text;       //字面量
+            int32_t arg = -1;   //参数序号，-1为字面量
+            sstring spec;       //带格式说明的字段，如"{:>8}"
+        };
+        vstring fmt_;
+        bool fallback_ = false; //无法预解析时交给fmt整体格式化
+        std::vector<piece> pieces_;
+    }; // class log_format
+
     class log_message {
     public:
         vstring tag() const { return tag_; }
-        vstring msg() const { return msg_; }
+        vstring msg() const { return size_ > MSG_INLINE ? vstring(overflow_) : vstring(buff_, size_); }
         int32_t line() const { return line_; }
         vstring source() const { return source_; }
         vstring feature() const { return feature_; }
+        uint32_t feature_id() const { return feature_id_; }
         int get_usec() { return log_time_.tm_usec; }
         log_level level() const { return level_; }
         time_t time() const { return log_time_.tm_time; }
-        const std::tm& logtime() const { return log_time_; }
-        void option(log_level level, sstring&& msg, cpchar tag, cpchar feature, cpchar source, int32_t line);
+        int64_t stamp() const { return log_time_.tm_stamp; }
+        const std::tm& logtime() const { return log_time::localtime(log_time_.tm_time); }
+        void option(log_level level, vstring msg, cpchar tag, cpchar feature, cpchar source, int32_t line);
+
+        //延迟格式化：生产者只记录格式串和二进制参数，日志线程调用resolve格式化
+        bool deferred() const { return deferred_; }
+        vstring vfmt() const { return fmt_; }
+        void defer(log_level level, vstring vfmt, cpchar tag, cpchar feature, cpchar source, int32_t line);
+        void push_arg(bool value);
+        void push_arg(double value);
+        void push_arg(int64_t value);
+        void push_arg(vstring value);
+        void resolve();
+
+        //飞行记录回放的日志，保留原时间戳，只写入记录目标
+        bool replayed() const { return replayed_; }
+        void replay(log_level level, int64_t stamp, vstring msg, vstring tag, vstring source, int32_t line, cpchar feature, bool deferred, vstring vfmt);
+        //按已格式化的字段恢复日志，用于共享内存收集
+        void restore(log_level level, int64_t stamp, vstring msg, vstring tag, vstring feature, vstring source, int32_t line, bool replayed);
+
+        //异步阶段持有计数：路由线程投递前hold，worker写完后release
+        //release/acquire保证worker对消息的读取在日志线程复用之前完成
+        void hold() { holds_.fetch_add(1, std::memory_order_relaxed); }
+        void release() { holds_.fetch_sub(1, std::memory_order_release); }
+        bool held() const { return holds_.load(std::memory_order_acquire) != 0; }
 
     private:
+        void assign(vstring msg);
+        void append(const void* data, size_t size);
+        void set_names(vstring tag, vstring feature, vstring source);
+
         int32_t             line_ = 0;
+        uint32_t            feature_id_ = 0;
+        size_t              size_ = 0;
         log_time            log_time_;
-        sstring             source_, msg_, feature_, tag_;
+        vstring             source_, feature_, tag_;
         log_level           level_ = log_level::LOG_LEVEL_DEBUG;
+        bool                deferred_ = false;
+        bool                replayed_ = false;
+        vstring             fmt_;
+        sstring             overflow_;
+        sstring             names_;     //驻留已满时保存tag/feature/source
+        std::atomic<uint32_t> holds_ = 0;
+        char                buff_[MSG_INLINE];
     }; // class log_message
     typedef std::vector<sptr<log_message>> log_messages;
 
+    //单线程写入的计数器，读取方在其他线程汇总
+    inline void count_add(std::atomic<size_t>& counter, size_t value) {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    //延迟直方图，按2的幂次划分微秒区间，单线程写入
+    class log_histogram {
+    public:
+        static const size_t BUCKETS = 26;
+        void record(int64_t us);
+
+        std::atomic<size_t> count = 0, sum = 0, max = 0;
+        std::array<std::atomic<size_t>, BUCKETS> buckets = {};
+    }; // class log_histogram
+
+    struct histogram_stats {
+        size_t count = 0;       //样本数
+        size_t sum = 0;         //总延迟(微秒)
+        size_t max = 0;         //最大延迟(微秒)
+        std::array<size_t, log_histogram::BUCKETS> buckets = {}; //第i个区间为[2^(i-1), 2^i)微秒
+    };
+
+    struct agent_stats {
+        size_t depth = 0;       //队列中的日志数
+        size_t capacity = 0;    //队列容量
+        size_t messages = 0;    //入队的日志数
+        size_t refills = 0;     //消息池批量分配次数
+    };
+
+    struct dest_stats {
+        size_t messages = 0;    //写入的日志数
+        size_t bytes = 0;       //写入的字节数
+        size_t remaps = 0;      //映射区扩展次数
+        size_t rotations = 0;   //滚动次数
+        size_t rotate_us = 0;   //滚动总耗时
+    };
+
+    struct log_stats {
+        std::map<uint32_t, agent_stats> agents;
+        std::map<sstring, dest_stats> dests;
+        histogram_stats latency;    //入队到写入完成的延迟
+        histogram_stats loop;       //日志线程处理一批日志的耗时
+        std::array<size_t, 7> drops = {};
+    };
+
     class log_message_pool {
     public:
         sptr<log_message> allocate();
         void recycle(sptr<log_messages> logmsgs);
+        size_t refills() const { return refills_.load(std::memory_order_relaxed); }
     private:
+        std::atomic<size_t> refills_ = 0;
         spin_mutex mutex_;
         sptr<log_messages> free_msgs_ = std::make_shared<log_messages>();
         sptr<log_messages> alloc_msgs_ = std::make_shared<log_messages>();
     }; // class log_message_pool
 
+    //单生产者单消费者无锁环形队列
+    //槽位带序号(Vyukov)，生产者可以从队头丢弃最旧的元素
+    template <typename T>
+    class spsc_queue {
+    public:
+        spsc_queue(size_t capacity) {
+            while (capacity_ < capacity) capacity_ <<= 1;
+            cells_ = std::make_unique<cell[]>(capacity_);
+            for (size_t i = 0; i < capacity_; ++i) {
+                cells_[i].seq.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        size_t capacity() const { return capacity_; }
+        size_t size() const {
+            size_t head = head_.load(std::memory_order_acquire);
+            return tail_.load(std::memory_order_acquire) - head;
+        }
+        bool empty() const { return size() == 0; }
+
+        //生产者线程调用，队列满时返回false
+        bool push(T&& value) {
+            size_t tail = tail_.load(std::memory_order_relaxed);
+            cell& slot = cells_[tail & (capacity_ - 1)];
+            //槽位还未被消费者释放
+            if (slot.seq.load(std::memory_order_acquire) != tail) return false;
+            slot.value = std::move(value);
+            slot.seq.store(tail + 1, std::memory_order_release);
+            tail_.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        //生产者线程调用，取出队头最旧的元素，队头正被消费者读取时返回false
+        bool steal(T& value) {
+            size_t head = head_.load(std::memory_order_relaxed);
+            while (true) {
+                cell& slot = cells_[head & (capacity_ - 1)];
+                if (slot.seq.load(std::memory_order_acquire) != head + 1) return false;
+                if (head_.compare_exchange_weak(head, head + 1, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+                    value = std::move(slot.value);
+                    slot.seq.store(head + capacity_, std::memory_order_release);
+                    return true;
+                }
+            }
+        }
+
+        //消费者线程调用，批量取出当前所有元素
+        template <typename F>
+        size_t drain(F&& fn) {
+            size_t head = head_.load(std::memory_order_relaxed);
+            size_t count = 0;
+            do {
+                count = 0;
+                while (count < capacity_ && cells_[(head + count) & (capacity_ - 1)].seq.load(std::memory_order_acquire) == head + count + 1) {
+                    ++count;
+                }
+                if (count == 0) return 0;
+            } while (!head_.compare_exchange_weak(head, head + count, std::memory_order_acq_rel, std::memory_order_relaxed));
+            for (size_t i = head; i < head + count; ++i) {
+                cell& slot = cells_[i & (capacity_ - 1)];
+                fn(std::move(slot.value));
+                slot.seq.store(i + capacity_, std::memory_order_release);
+            }
+            return count;
+        }
+
+        //只读遍历队列中的元素，不取出也不修改，用于崩溃时导出
+        template <typename F>
+        void peek(F&& fn) const {
+            size_t head = head_.load(std::memory_order_acquire);
+            for (size_t i = head; i < head + capacity_; ++i) {
+                const cell& slot = cells_[i & (capacity_ - 1)];
+                if (slot.seq.load(std::memory_order_acquire) != i + 1) break;
+                fn(slot.value);
+            }
+        }
+
+    private:
+        struct cell {
+            std::atomic<size_t> seq;
+            T value;
+        };
+        size_t capacity_ = 2;
+        std::unique_ptr<cell[]> cells_;
+        alignas(CACHE_LINE) std::atomic<size_t> head_ = 0;
+        alignas(CACHE_LINE) std::atomic<size_t> tail_ = 0;
+    }; // class spsc_queue
+
+    class log_waker {
+    public:
+        void wakeup();
+        void notify(log_level level);
+        void wait(std::function<bool()> pending);
+        void set_mode(wait_mode mode) { mode_ = mode; }
+        void set_delay(size_t delay) { delay_ = delay; }
+
+    private:
+        std::mutex mutex_;
+        size_t spins_ = 0;
+        std::atomic_bool parked_ = false;
+        std::condition_variable condv_;
+        std::atomic<wait_mode> mode_ = wait_mode::ADAPTIVE;
+        std::atomic<size_t> delay_ = 0;
+    }; // class log_waker
+
     class log_message_queue {
     public:
-        void put(sptr<log_message> logmsg);
-        sptr<log_messages> timed_getv(bool running);
+        log_message_queue(size_t capacity) : ring_(capacity) { read_msgs_->reserve(ring_.capacity()); }
+        bool empty() const { return ring_.empty(); }
+        size_t capacity() const { return ring_.capacity(); }
+        size_t size() const { return ring_.size(); }
+        bool put(sptr<log_message> logmsg) { return ring_.push(std::move(logmsg)); }
+        bool steal(sptr<log_message>& logmsg) { return ring_.steal(logmsg); }
+        template <typename F>
+        void peek(F&& fn) const { ring_.peek(fn); }
+        sptr<log_messages> timed_getv();
     private:
-        spin_mutex mutex_;
+        spsc_queue<sptr<log_message>> ring_;
         sptr<log_messages> read_msgs_ = std::make_shared<log_messages>();
-        sptr<log_messages> write_msgs_ = std::make_shared<log_messages>();
     }; // class log_message_queue
 
+    //队列溢出控制，由服务和所有agent共享
+    class log_overflow {
+    public:
+        overflow_policy policy() const { return policy_.load(std::memory_order_relaxed); }
+        log_level level() const { return level_.load(std::memory_order_relaxed); }
+        //全局容量平分给各agent后的单队列上限
+        size_t share() const { return share_.load(std::memory_order_relaxed); }
+        //不低于该级别的日志不入队，由生产者线程同步写入
+        log_level sync_level() const { return sync_level_.load(std::memory_order_relaxed); }
+        void set_sync_level(log_level level) { sync_level_ = level; }
+        void set_policy(overflow_policy policy, log_level level) { policy_ = policy; level_ = level; }
+        void set_capacity(size_t capacity) { capacity_ = capacity; update_share(); }
+        void set_agents(size_t agents) { agents_ = agents; update_share(); }
+        void drop(log_level level) { drops_[(int)level].fetch_add(1, std::memory_order_relaxed); }
+        std::array<size_t, 7> drops() const;
+        //日志线程调用，返回上次汇总后新增的丢弃统计，没有丢弃或距上次汇总不足1秒时返回空
+        sstring summary(bool force);
+
+    private:
+        void update_share();
+
+        std::atomic<overflow_policy> policy_ = overflow_policy::BLOCK;
+        std::atomic<log_level> level_ = log_level::LOG_LEVEL_WARN;
+        std::atomic<log_level> sync_level_ = log_level::LOG_LEVEL_FATAL;
+        std::atomic<size_t> capacity_ = 0, agents_ = 0, share_ = SIZE_MAX;
+        alignas(CACHE_LINE) std::array<std::atomic<size_t>, 7> drops_ = {};
+        std::array<size_t, 7> reported_ = {};
+        steady_clock::time_point last_summary_;
+    }; // class log_overflow
+
+    //限流规则：令牌桶限速和1/N采样
+    class limit_rule {
+    public:
+        limit_rule(limit_type type, cpchar key, double rate, size_t burst, size_t sample)
+            : type_(type), key_(key), rate_(rate), burst_((double)std::max<size_t>(1, burst)), sample_(sample), tokens_(burst_) {}
+
+        bool allow();
+        //now为单调时钟的微秒数
+        bool allow(int64_t now);
+        limit_type type() const { return type_; }
+        const sstring& key() const { return key_; }
+        //日志线程调用，返回上次汇总后新增的抑制数量
+        size_t report();
+
+    private:
+        limit_type type_;
+        sstring key_;
+        double rate_, burst_;
+        size_t sample_;
+        spin_mutex mutex_;
+        double tokens_;
+        int64_t last_ = 0;
+        size_t seen_ = 0, reported_ = 0;
+        std::atomic<size_t> suppressed_ = 0;
+    }; // class limit_rule
+
+    using limit_rules = std::array<std::map<sstring, sptr<limit_rule>, std::less<>>, 3>;
+
+    //限流器，规则写时复制，agent按版本号缓存规则快照
+    class log_limiter {
+    public:
+        bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+        bool has_source() const { return has_source_.load(std::memory_order_relaxed); }
+        size_t version() const { return version_.load(std::memory_order_acquire); }
+        sptr<limit_rules> rules();
+        //rate和sample都为0时删除规则
+        void set_limit(limit_type type, cpchar key, double rate, size_t burst, size_t sample);
+        static bool allow(const limit_rules& rules, vstring tag, vstring feature, vstring source, int line);
+        //日志线程调用，汇总被抑制的日志数，非强制时每秒最多一次
+        std::vector<std::pair<sptr<limit_rule>, size_t>> summary(bool force);
+
+    private:
+        spin_mutex mutex_;
+        sptr<limit_rules> rules_ = std::make_shared<limit_rules>();
+        std::atomic<size_t> version_ = 0;
+        std::atomic_bool enabled_ = false, has_source_ = false;
+        steady_clock::time_point last_summary_;
+    }; // class log_limiter
+
+    //飞行记录配置，由服务和所有agent共享
+    class log_flight {
+    public:
+        bool enabled() const { return capacity_.load(std::memory_order_relaxed) > 0; }
+        size_t capacity() const { return capacity_.load(std::memory_order_relaxed); }
+        //记录不高于level的日志，不低于trigger的日志触发回放
+        log_level level() const { return level_.load(std::memory_order_relaxed); }
+        log_level trigger() const { return trigger_.load(std::memory_order_relaxed); }
+        cpchar feature() const { return feature_.load(std::memory_order_acquire); }
+        //capacity为0时关闭
+        void set(cpchar feature, size_t capacity, log_level level, log_level trigger);
+
+    private:
+        std::atomic<cpchar> feature_ = "";
+        std::atomic<size_t> capacity_ = 0;
+        std::atomic<log_level> level_ = log_level::LOG_LEVEL_INFO;
+        std::atomic<log_level> trigger_ = log_level::LOG_LEVEL_ERROR;
+    }; // class log_flight
+
+    //飞行记录环，单线程读写，按写入顺序保存变长记录，空间不足时淘汰最旧的记录
+    //延迟格式化的日志保存格式串和二进制参数，回放时才格式化
+    class log_recorder {
+    public:
+        struct record_head {
+            int64_t stamp = 0;
+            cpchar vfmt = nullptr;      //驻留的格式串
+            uint32_t vfmt_len = 0;
+            uint32_t msg_len = 0;
+            int32_t line = 0;
+            uint16_t tag_len = 0;
+            uint16_t source_len = 0;
+            log_level level = log_level::LOG_LEVEL_DEBUG;
+            bool deferred = false;
+        };
+
+        log_recorder(size_t capacity);
+        size_t capacity() const { return capacity_; }
+        bool empty() const { return head_ == tail_; }
+        void record(record_head head, vstring tag, vstring source, vstring msg);
+        //从旧到新回放并清空
+        template <typename F>
+        void replay(F&& fn) {
+            thread_local sstring t_data;
+            while (head_ < tail_) {
+                record_head head;
+                get(head_, &head, sizeof(head));
+                size_t size = head.tag_len + head.source_len + head.msg_len;
+                t_data.resize(size);
+                get(head_ + sizeof(head), t_data.data(), size);
+                head_ += sizeof(head) + size;
+                vstring data = t_data;
+                fn(head, data.substr(0, head.tag_len), data.substr(head.tag_len, head.source_len), data.substr(head.tag_len + head.source_len));
+            }
+        }
+
+    private:
+        void put(size_t pos, const void* data, size_t size);
+        void get(size_t pos, void* data, size_t size) const;
+
+        size_t capacity_ = 0;
+        size_t head_ = 0, tail_ = 0;   //单调递增的读写位置
+        std::unique_ptr<char[]> buf_;
+    }; // class log_recorder
+
     class log_dest {
     public:
         virtual void flush() {};
+        //把已写入的内容同步到磁盘，调用方需保证与写入线程互斥
+        virtual void sync() {};
+        //崩溃处理中调用，只做信号安全的操作，不能碰写入线程正在修改的状态
+        virtual void crash_sync() {};
         virtual void write(sptr<log_message> logmsg);
         virtual void set_clean_time(size_t clean_time) {}
-        virtual void raw_write(sstring& msg, log_level lvl) = 0;
+        virtual void set_chunk_size(size_t chunk_size) {}
+        virtual void raw_write(vstring msg, log_level lvl) = 0;
         virtual void ignore_prefix(bool prefix) { ignore_prefix_ = prefix; }
         virtual void ignore_suffix(bool suffix) { ignore_suffix_ = suffix; }
-        virtual cstring build_prefix(sptr<log_message> logmsg);
-        virtual cstring build_suffix(sptr<log_message> logmsg);
+        virtual dest_stats stats() const;
+
+        //格式化一行日志(含换行)到out，返回写入结束位置，out至少需要line_size字节
+        virtual char* format_line(char* out, const sptr<log_message>& logmsg);
+        virtual size_t line_size(const sptr<log_message>& logmsg) const;
 
     protected:
+        vstring format_time(const sptr<log_message>& logmsg);
+        char* format_prefix(char* out, const sptr<log_message>& logmsg);
+        char* format_suffix(char* out, const sptr<log_message>& logmsg);
+        void count_write(size_t bytes) { count_add(messages_, 1); count_add(bytes_, bytes); }
+
+        std::atomic<size_t> messages_ = 0, bytes_ = 0, remaps_ = 0, rotations_ = 0, rotate_us_ = 0;
         time_t last_time_ = 0;
+        size_t time_len_ = 0;
         char time_buf_[32] = {0};
         bool ignore_suffix_ = true;
         bool ignore_prefix_ = false;
     }; // class log_dest
 
+    //控制台目标，一批日志缓存后一次写入fd，终端下才输出颜色
     class stdio_dest : public log_dest {
     public:
+        stdio_dest();
+        ~stdio_dest() { flush(); }
+        virtual void flush();
         virtual void write(sptr<log_message> logmsg);
-        virtual void raw_write(sstring& msg, log_level lvl);
+        virtual void raw_write(vstring msg, log_level lvl);
+        //ERROR和FATAL输出到stderr
+        void set_stderr(bool on) { stderr_ = on; }
+
+    protected:
+        char* begin_line(fmt::memory_buffer& buf, size_t size, log_level lvl, bool colored);
+        void end_line(fmt::memory_buffer& buf, char* out, bool colored);
+        void write_fd(int fd, fmt::memory_buffer& buf);
+
+        fmt::memory_buffer out_buf_, err_buf_;
+        bool out_colored_ = false, err_colored_ = false;
+        std::atomic_bool stderr_ = false;
     }; // class stdio_dest
 
+    struct stage_stats {
+        size_t pending = 0;     //队列中待写入的日志数
+        size_t written = 0;     //已写入的日志数
+        size_t stalls = 0;      //队列满导致路由线程等待的次数
+        size_t lag_us = 0;      //最近一批日志从入队到写完的延迟
+        size_t max_lag_us = 0;  //最大延迟
+    };
+
+    //异步写入阶段，包装一个目标，路由线程只投递消息引用，由worker线程写入
+    class log_stage : public log_dest {
+    public:
+        log_stage(cpchar name, sptr<log_dest> dest, sptr<log_waker> waker, size_t capacity)
+            : name_(name), dest_(dest), waker_(waker), ring_(capacity) {}
+
+        //目标由worker在每批写完后刷新
+        virtual void flush() {}
+        //请求worker写完已入队的日志后落盘，调用线程最多等待STAGE_SYNC毫秒，不直接操作被包装的目标
+        virtual void sync();
+        virtual void crash_sync() { dest_->crash_sync(); }
+        virtual void write(sptr<log_message> logmsg);
+        virtual void raw_write(vstring msg, log_level lvl) { dest_->raw_write(msg, lvl); }
+        virtual void set_clean_time(size_t clean_time) { dest_->set_clean_time(clean_time); }
+        virtual void set_chunk_size(size_t chunk_size) { dest_->set_chunk_size(chunk_size); }
+        virtual void ignore_prefix(bool prefix) { dest_->ignore_prefix(prefix); }
+        virtual void ignore_suffix(bool suffix) { dest_->ignore_suffix(suffix); }
+        virtual dest_stats stats() const { return dest_->stats(); }
+
+        const sstring& name() const { return name_; }
+        sptr<log_dest> dest() const { return dest_; }
+        bool pending() const { return !ring_.empty() || sync_req_ != sync_done_; }
+        bool closed() const { return closed_; }
+        void close() { closed_ = true; }
+        stage_stats lag_stats() const;
+        //worker线程调用，写入当前队列中的所有日志
+        size_t consume();
+
+    private:
+        struct stage_item {
+            sptr<log_message> logmsg;
+            int64_t time = 0;
+        };
+        sstring name_;
+        sptr<log_dest> dest_;
+        sptr<log_waker> waker_;
+        spsc_queue<stage_item> ring_;
+        std::atomic_bool closed_ = false;
+        std::mutex sync_mutex_;
+        std::condition_variable sync_condv_;
+        std::atomic<size_t> sync_req_ = 0, sync_done_ = 0;
+        std::atomic<size_t> written_ = 0, stalls_ = 0, lag_us_ = 0, max_lag_us_ = 0;
+    }; // class log_stage
+
+    //异步阶段的工作线程，可由多个阶段共享
+    class log_stage_worker {
+    public:
+        ~log_stage_worker() { stop(); }
+        sptr<log_waker> waker() const { return waker_; }
+        void add(sptr<log_stage> stage);
+        void start();
+        void stop();
+
+    private:
+        void run();
+
+        spin_mutex mutex_;
+        std::thread thread_;
+        std::atomic_bool running_ = false;
+        sptr<log_waker> waker_ = std::make_shared<log_waker>();
+        std::vector<sptr<log_stage>> stages_;
+        std::vector<sptr<log_stage>> snapshot_;    //worker线程复用的阶段列表
+    }; // class log_stage_worker
+
+    //文件写入后端，在文件末尾预留空间写入，由单个线程使用
+    class log_backend {
+    public:
+        log_backend(std::atomic<size_t>& remaps) : remaps_(remaps) {}
+        virtual ~log_backend() {}
+        //打开文件从末尾追加，size返回文件已有长度
+        virtual bool open(const sstring& file_path, size_t& size) = 0;
+        virtual void close() = 0;
+        virtual bool is_open() const = 0;
+        //预留size字节，写入后用commit提交实际长度
+        virtual char* reserve(size_t size) = 0;
+        virtual void commit(size_t size) = 0;
+        //一批日志写完后调用
+        virtual void flush() {}
+        //同步到磁盘，由写入线程调用
+        virtual void sync() = 0;
+        //崩溃处理中调用，默认不做任何事
+        virtual void crash_sync() {}
+        void set_chunk_size(size_t chunk_size) { chunk_size_ = chunk_size; }
+
+    protected:
+        std::atomic<size_t>& remaps_;
+        size_t chunk_size_ = CHUNK_SIZE;
+    }; // class log_backend
+
+    class mmap_backend : public log_backend {
+    public:
+        using log_backend::log_backend;
+        ~mmap_backend() { close(); }
+        virtual bool open(const sstring& file_path, size_t& size);
+        virtual void close();
+        virtual bool is_open() const { return buff_ != nullptr; }
+        virtual char* reserve(size_t size);
+        virtual void commit(size_t size) { size_ += size; }
+        virtual void sync();
+        //只对映射区域做msync
+        virtual void crash_sync() { sync(); }
+
+    protected:
+        void map_file(size_t alc_size);
+        void unmap_file();
+
+        size_t          size_ = 0, alc_size_ = 0;
+        char*           buff_ = nullptr;
+        sstring         file_path_;
+        int             fd_ = -1;
+    }; // class mmap_backend
+
+#ifndef WIN32
+    //批量写入后端，日志格式化到对齐缓冲区，flush时把待写缓冲区作为一次写入提交
+    //同一时间只有一次写入在途，io_uring不可用或失败时用pwritev同步写入
+    class batch_backend : public log_backend {
+    public:
+        batch_backend(std::atomic<size_t>& remaps);
+        ~batch_backend();
+        virtual bool open(const sstring& file_path, size_t& size);
+        virtual void close();
+        virtual bool is_open() const { return fd_ >= 0; }
+        virtual char* reserve(size_t size);
+        virtual void commit(size_t size) { buffers_[current_ % IO_BUFFERS].used += size; }
+        virtual void flush();
+        virtual void sync();
+        bool async() const;
+
+    protected:
+        struct io_buffer {
+            char* data = nullptr;
+            size_t capacity = 0, used = 0;
+        };
+        void submit();
+        void wait();
+        void release();
+        void write_all(size_t offset);
+
+        //缓冲区按序号循环使用：[head_, submit_)在途，[submit_, current_)待提交，current_正在写入
+        std::array<io_buffer, IO_BUFFERS> buffers_;
+        std::array<iovec, IO_BUFFERS> iovs_;
+        size_t head_ = 0, submit_ = 0, current_ = 0;
+        size_t offset_ = 0, inflight_offset_ = 0, inflight_bytes_ = 0;
+        int fd_ = -1;
+#ifdef LOG_URING
+        bool setup_ring();
+        void close_ring();
+        bool ring_submit();
+        int ring_wait();
+
+        int             ring_fd_ = -1;
+        void*           sq_ptr_ = nullptr, *cq_ptr_ = nullptr;
+        size_t          sq_len_ = 0, cq_len_ = 0, sqes_len_ = 0;
+        unsigned*       sq_tail_ = nullptr, *sq_mask_ = nullptr, *sq_array_ = nullptr;
+        unsigned*       cq_head_ = nullptr, *cq_tail_ = nullptr, *cq_mask_ = nullptr;
+        io_uring_sqe*   sqes_ = nullptr;
+        io_uring_cqe*   cqes_ = nullptr;
+#endif // LOG_URING
+    }; // class batch_backend
+#endif // WIN32
+
+#ifndef WIN32
+    //多进程共享内存通道，每个进程占一个槽位，日志线程把格式化后的日志写入槽位的字节环
+    //flock选出一个收集进程，读取所有槽位并写文件，收集进程退出后由其他进程接替
+    //共享内存只允许同一用户访问，最后退出的进程在日志读完时删除
+    class log_shm {
+    public:
+        ~log_shm();
+        bool open(cpchar name, size_t ring_size);
+        bool collector() const { return collector_; }
+        //每秒最多尝试一次成为收集进程
+        bool elect();
+        //非收集进程调用，环满时等待收集进程，超时后丢弃，直到环有空间前不再等待
+        //hurry非0表示有同步写入在等待日志线程，此时环满立即丢弃
+        bool publish(const sptr<log_message>& logmsg, const std::atomic<size_t>& hurry);
+        //收集进程调用，每个槽位最多读取limit条，回收已退出进程的槽位
+        void collect(log_messages& logmsgs, log_message_pool& pool, size_t limit);
+        bool pending() const;
+
+    private:
+        struct shm_slot {
+            //0空闲，低32位为pid，高位为进程启动时间，避免pid复用时误判；负数为正常退出的进程
+            alignas(CACHE_LINE) std::atomic<int64_t> owner;
+            std::atomic<uint32_t> drops;
+            alignas(CACHE_LINE) std::atomic<uint64_t> tail; //写位置，由所属进程更新
+            alignas(CACHE_LINE) std::atomic<uint64_t> head; //读位置，由收集进程更新
+        };
+        struct shm_record {
+            int64_t stamp;
+            int32_t line;
+            uint32_t msg_len;
+            uint16_t tag_len, feature_len, source_len;
+            uint8_t level, replayed;
+        };
+        static int64_t make_owner(int32_t pid);
+        static bool alive(int64_t owner);
+        //所有槽位空闲或所属进程已退出且日志已读完
+        bool idle() const;
+        char* ring(size_t index) const { return rings_ + index * ring_size_; }
+        void put(char* ring, uint64_t pos, const void* data, size_t size);
+        void get(const char* ring, uint64_t pos, void* data, size_t size) const;
+
+        int fd_ = -1;
+        sstring name_;
+        int64_t owner_ = 0;
+        size_t size_ = 0, ring_size_ = 0, index_ = SHM_SLOTS;
+        shm_slot* slots_ = nullptr;
+        char* rings_ = nullptr;
+        std::atomic_bool collector_ = false;
+        bool stalled_ = false;
+        sstring buf_;
+        steady_clock::time_point last_elect_, last_check_;
+    }; // class log_shm
+#endif // WIN32
+
+    //稀疏索引的一项，记录一块日志的偏移、时间范围和级别位图，块从日志行的起始位置开始
+    struct index_block {
+        uint64_t offset = 0;
+        uint64_t size = 0;
+        int64_t min_stamp = INT64_MAX;  //微秒时间戳
+        int64_t max_stamp = 0;
+        uint32_t levels = 0;            //第level位表示块中有该级别的日志
+        uint32_t count = 0;
+    };
+
+    //日志文件的稀疏索引，写在日志文件同名的.idx文件中，每INDEX_BLOCK字节一项
+    //查询时只读取时间和级别可能匹配的块，再按行前缀过滤，没有索引项覆盖的部分整体扫描
+    class log_index {
+    public:
+        using line_fn = std::function<bool(vstring line)>;
+        static path index_path(const path& file_path) { return file_path.string() + ".idx"; }
+        //按文件名顺序查询目录(含子目录)下的.log文件，输出[from, to]微秒内、级别在levels位图中的日志行
+        //levels为0时不过滤级别，fn返回false时停止，返回输出的行数
+        static size_t query(const path& log_path, int64_t from, int64_t to, uint32_t levels, const line_fn& fn);
+        static size_t query_file(const path& file_path, int64_t from, int64_t to, uint32_t levels, const line_fn& fn, bool& stop);
+        static std::vector<index_block> load(const path& file_path);
+    }; // class log_index
+
     class log_file_base : public log_dest {
     public:
-        log_file_base(size_t max_size) : size_(0), alc_size_(USHRT_MAX), max_size_(max_size > USHRT_MAX ? max_size : USHRT_MAX) {}
+        log_file_base(size_t max_size) : size_(0), max_size_(max_size > USHRT_MAX ? max_size : USHRT_MAX) {}
         virtual ~log_file_base();
 
         const std::tm& file_time() const { return file_time_; }
-        virtual void raw_write(sstring& msg, log_level lvl);
+        virtual void flush();
+        virtual void sync();
+        virtual void crash_sync();
+        virtual void write(sptr<log_message> logmsg);
+        virtual void raw_write(vstring msg, log_level lvl);
+        virtual void set_chunk_size(size_t chunk_size);
         bool create(path file_path, sstring file_name, const std::tm& file_time);
+        bool is_open() const { return backend_ && backend_->is_open(); }
+        //切换文件后端和fdatasync间隔(毫秒，0不主动同步)，在下次创建文件时生效
+        void set_backend(io_backend backend, size_t sync_ms) { backend_type_ = backend; sync_ms_ = sync_ms; }
+        //为文件写稀疏索引，在下次创建文件时生效
+        void set_index(bool on) { index_on_ = on; }
+        //查询按文本行前缀过滤，没有该前缀的格式不能建索引
+        virtual bool indexable() const { return true; }
+
+        //在文件末尾预留size字节，格式化后用commit提交实际长度
+        char* reserve(size_t size) { return backend_ ? backend_->reserve(size) : nullptr; }
+        void commit(size_t size) { backend_->commit(size); size_ += size; }
 
     protected:
-        void map_file();
-        void unmap_file();
+        void close_file();
         bool check_full(size_t size);
+        void open_index();
+        void close_index();
+        void index(const sptr<log_message>& logmsg, size_t offset, size_t size);
 
     protected:
         std::tm         file_time_;
-        size_t          size_, alc_size_, max_size_;
-        char* buff_ = nullptr;
+        size_t          size_, max_size_;
+        size_t          chunk_size_ = CHUNK_SIZE;
         sstring         file_path_;
+        std::unique_ptr<log_backend> backend_ = nullptr;
+        io_backend      current_type_ = io_backend::MMAP;
+        std::atomic<io_backend> backend_type_ = io_backend::MMAP;
+        std::atomic<size_t> sync_ms_ = 0;
+        steady_clock::time_point last_sync_;
+        std::atomic_bool index_on_ = false;
+        FILE*           index_file_ = nullptr;
+        index_block     block_;
     }; // class log_file
 
     class rolling_hourly {
@@ -177,13 +934,110 @@ namespace logger {
         bool eval(const log_file_base* log_file, const sptr<log_message> logmsg) const;
     }; // class rolling_daily
 
+    struct clean_policy {
+        size_t clean_time = CLEAN_TIME;     //过期时间(秒)
+        size_t clean_count = 0;             //保留的最大文件数，0不限制
+        size_t clean_size = 0;              //保留的最大总字节数，0不限制
+    }; // struct clean_policy
+
+    struct compress_stats {
+        size_t pending = 0;         //等待压缩的文件数
+        size_t finished = 0;        //已压缩的文件数
+        size_t dropped = 0;         //队列满未压缩的文件数
+        size_t failed = 0;          //压缩失败的文件数
+        size_t bytes_in = 0;        //压缩前总字节数
+        size_t bytes_out = 0;       //压缩后总字节数
+        size_t cost_ms = 0;         //压缩总耗时
+    }; // struct compress_stats
+
+    using compress_done = std::function<void(const path& file_path, const path& gz_path)>;
+
+    //后台压缩滚动后的日志文件，队列满时跳过，不阻塞调用方
+    class log_compressor {
+    public:
+        ~log_compressor() { stop(); }
+        void stop();
+        bool enable() const { return level_ > 0; }
+        compress_stats stats() const;
+        void option(int level, size_t threads, size_t queue_size);
+        void compress(const path& file_path, compress_done done);
+
+    protected:
+        void run();
+        bool gzip(const path& file_path, const path& gz_path, size_t& bytes_in, size_t& bytes_out);
+
+        struct compress_task {
+            path file_path;
+            compress_done done;
+        };
+
+        std::mutex mutex_;
+        bool running_ = false;
+        bool stopped_ = false;      //停止后不再接收任务，也不再启动线程
+        std::condition_variable condv_;
+        std::vector<std::thread> threads_;
+        std::deque<compress_task> tasks_;
+        std::atomic<int> level_ = 0;
+        size_t threads_num_ = 1, queue_size_ = QUEUE_SIZE;
+        std::atomic<size_t> finished_ = 0, dropped_ = 0, failed_ = 0, bytes_in_ = 0, bytes_out_ = 0, cost_ms_ = 0;
+    }; // class log_compressor
+
+    //后台清理线程，按目标(目录+文件名中的feature)维护已知日志文件索引
+    //同一目录下可能有多个目标的文件，各目标只清理自己的文件
+    class log_cleaner {
+    public:
+        ~log_cleaner();
+        sptr<log_compressor> compressor() const { return compressor_; }
+        //file_path为新建的文件，prev_path为刚关闭的上一个文件，写完的文件按路径交给压缩线程
+        void rotate(const path& log_path, cpchar feature, const path& file_path, const path& prev_path, const clean_policy& policy);
+        void replace(const path& log_path, cpchar feature, const path& file_path, const path& gz_path);
+        //从滚动文件名中取出feature，不是滚动文件时返回空
+        static sstring file_feature(const path& file_path);
+
+    protected:
+        struct clean_file {
+            path file_path;
+            size_t size = 0;
+        };
+        struct clean_dest {
+            bool scanned = false;
+            size_t total_size = 0;
+            std::set<path> known;
+            std::multimap<file_time_type, clean_file> files;
+            std::multimap<file_time_type, clean_file>::iterator last;
+        };
+        struct clean_task {
+            path log_path;
+            sstring feature;
+            path file_path;
+            clean_policy policy;
+            file_time_type time;
+            path replace_path;      //非空时表示file_path被压缩为replace_path
+            path prev_path;         //滚动时关闭的文件
+        };
+
+        void run();
+        void scan(const clean_task& task, clean_dest& dest);
+        void rotate(const clean_task& task, clean_dest& dest);
+        void replace(const clean_task& task, clean_dest& dest);
+        void clean(clean_dest& dest, const clean_policy& policy);
+
+        std::mutex mutex_;
+        std::thread thread_;
+        bool running_ = false;
+        std::condition_variable condv_;
+        std::deque<clean_task> tasks_;
+        std::map<std::pair<sstring, sstring>, clean_dest> dests_;
+        sptr<log_compressor> compressor_ = std::make_shared<log_compressor>();
+    }; // class log_cleaner
+
     template<class rolling_evaler>
     class log_rollingfile : public log_file_base {
     public:
-        log_rollingfile(path& log_path, cpchar namefix, size_t max_szie = MAX_SIZE, size_t clean_time = CLEAN_TIME);
+        log_rollingfile(path& log_path, cpchar namefix, size_t max_szie = MAX_SIZE, clean_policy policy = {}, sptr<log_cleaner> cleaner = nullptr);
 
         virtual void write(sptr<log_message> logmsg);
-        virtual void set_clean_time(size_t clean_time) { clean_time_ = clean_time; }
+        virtual void set_clean_time(size_t clean_time) { policy_.clean_time = clean_time; }
 
     protected:
         sstring new_log_file_name(const sptr<log_message> logmsg);
@@ -191,12 +1045,30 @@ namespace logger {
         path                    log_path_;
         sstring                 feature_;
         rolling_evaler          rolling_evaler_;
-        size_t                  clean_time_ = CLEAN_TIME;
+        clean_policy            policy_;
+        sptr<log_cleaner>       cleaner_ = nullptr;
     }; // class log_rollingfile
 
     typedef log_rollingfile<rolling_hourly> log_hourlyrollingfile;
     typedef log_rollingfile<rolling_daily> log_dailyrollingfile;
 
+    //json字符串转义，out至少需要str长度的6倍
+    char* json_escape(char* out, vstring str);
+
+    //json行格式的滚动日志，每行一个json对象
+    template<class rolling_evaler>
+    class log_jsonfile : public log_rollingfile<rolling_evaler> {
+    public:
+        using log_rollingfile<rolling_evaler>::log_rollingfile;
+
+        virtual char* format_line(char* out, const sptr<log_message>& logmsg);
+        virtual size_t line_size(const sptr<log_message>& logmsg) const;
+        virtual bool indexable() const { return false; }
+    }; // class log_jsonfile
+
+    typedef log_jsonfile<rolling_hourly> log_hourlyjsonfile;
+    typedef log_jsonfile<rolling_daily> log_dailyjsonfile;
+
     class log_service;
     class log_agent : public std::enable_shared_from_this<log_agent> {
     public:
@@ -207,27 +1079,75 @@ namespace logger {
         void attach(wptr<log_service> service);
         void recycle(sptr<log_messages> logmsgs) { message_pool_->recycle(logmsgs); }
         bool is_filter(log_level lv) { return 0 == (filter_bits_ & (1 << ((int)lv - 1))); }
-        sptr<log_messages> timed_getv(bool running) {  return logmsgque_->timed_getv(running); }
-        void output(log_level level, sstring&& msg, cpchar tag, cpchar feature, cpchar source = "", int line = 0);
+        bool pending() const { return !logmsgque_->empty(); }
+        sptr<log_messages> timed_getv() {  return logmsgque_->timed_getv(); }
+        void output(log_level level, vstring msg, cpchar tag, cpchar feature, cpchar source = "", int line = 0);
+        //不经过过滤和限流直接提交
+        void commit(log_level level, vstring msg, cpchar tag, cpchar feature, cpchar source = "", int line = 0);
+        agent_stats stats() const;
+        bool limiting() const { return limiter_ && limiter_->enabled(); }
+        bool limiting_source() const { return limiter_ && limiter_->has_source(); }
+        bool limited(vstring tag, vstring feature, vstring source, int line);
+        sptr<log_message> allocate() { return message_pool_->allocate(); }
+        void push(sptr<log_message> logmsg);
+        //飞行记录，被过滤的日志也写入
+        bool recording(log_level level) const { return flight_ && flight_->enabled() && level <= flight_->level(); }
+        void record(log_level level, vstring msg, cpchar tag, cpchar source = "", int line = 0);
+        void record(const log_message& logmsg);
+        template <typename F>
+        void peek(F&& fn) const { logmsgque_->peek(fn); }
 
     protected:
+        bool overflow(sptr<log_message>& logmsg);
+        log_recorder* recorder();
+        void replay();
+
         int32_t filter_bits_ = -1;
+        std::atomic<size_t> messages_ = 0;
         wptr<log_service> service_;
+        sptr<log_waker> waker_ = nullptr;
+        sptr<log_overflow> overflow_ = nullptr;
+        sptr<log_limiter> limiter_ = nullptr;
+        sptr<limit_rules> limit_rules_ = nullptr;
+        size_t limit_version_ = 0;
+        sptr<log_flight> flight_ = nullptr;
+        std::unique_ptr<log_recorder> recorder_;
+        size_t record_capacity_ = 0;
         sptr<log_message_queue> logmsgque_ = nullptr;
         sptr<log_message_pool> message_pool_ = nullptr;
     }; // class log_agent
 
+    //路由快照，配置变更时重建并整体发布，路由线程每轮取一次，写日志时不加锁
+    struct log_routes {
+        sptr<log_dest> std_dest = nullptr;
+        sptr<log_dest> main_dest = nullptr;
+        std::array<sptr<log_dest>, 7> lvl_dests;        //按级别索引
+        std::vector<sptr<log_dest>> feature_dests;      //按feature编号索引
+        std::vector<sptr<log_agent>> agents;
+#ifndef WIN32
+        sptr<log_shm> shm = nullptr;                    //共享模式的通道
+#endif
+    };
+
     class log_service : public std::enable_shared_from_this<log_service> {
     public:
         log_service();
         ~log_service();
 
+        bool is_running() const { return running_; }
+        sptr<log_waker> waker() const { return waker_; }
+        sptr<log_overflow> overflow() const { return overflow_; }
+        sptr<log_limiter> limiter() const { return limiter_; }
+        sptr<log_flight> flight() const { return flight_; }
+        size_t queue_size() const { return queue_size_; }
         void daemon(bool status) { log_daemon_ = status; }
+        void set_stderr(bool on) { stdio_->set_stderr(on); }
         void option(cpchar log_path, cpchar service, cpchar index);
 
         bool add_dest(cpchar feature);
         bool add_lvl_dest(log_level log_lvl);
         bool add_file_dest(cpchar feature, cpchar fname);
+        bool add_json_dest(cpchar feature);
 
         void del_dest(cpchar feature);
         void del_lvl_dest(log_level log_lvl);
@@ -239,28 +1159,103 @@ namespace logger {
         void ignore_suffix(cpchar feature, bool suffix);
 
         void set_max_size(size_t max_size) { max_size_ = max_size; }
+        void set_queue_size(size_t queue_size) { queue_size_ = queue_size; }
+        void set_chunk_size(size_t chunk_size) { chunk_size_ = chunk_size; }
+        void set_wait_mode(wait_mode mode) { waker_->set_mode(mode); }
+        void set_wait_delay(size_t delay) { waker_->set_delay(delay); }
+        void set_overflow_policy(overflow_policy policy, log_level level = log_level::LOG_LEVEL_WARN) { overflow_->set_policy(policy, level); }
+        void set_global_capacity(size_t capacity) { overflow_->set_capacity(capacity); }
+        void set_sync_level(log_level level) { overflow_->set_sync_level(level); }
+        //设置文件目标的写入后端和fdatasync间隔(毫秒)，在下次创建文件时生效
+        //feature为"main"对应主日志
+        bool set_dest_backend(cpchar feature, io_backend backend, size_t sync_ms = 0);
+        bool set_lvl_backend(log_level log_lvl, io_backend backend, size_t sync_ms = 0);
+        //为文件目标写稀疏索引，在下次创建文件时生效，用log_index::query查询；json目标不支持，返回false
+        bool set_dest_index(cpchar feature, bool on);
+        bool set_lvl_index(log_level log_lvl, bool on);
+        //生产者线程调用，先写完该线程已入队的日志再写入logmsg并落盘
+        //异步目标由其worker写入并落盘，调用线程等待完成
+        void write_sync(log_agent* agent, sptr<log_message> logmsg);
+        //安装SIGSEGV/SIGBUS/SIGFPE/SIGABRT处理，崩溃时导出各线程未写入的日志，需在option之后调用
+        //处理函数运行在备用栈上，备用栈只为调用线程设置
+        bool install_crash_handler();
+        //共享内存收集模式：同名的多个进程中只有选出的收集进程写文件，其他进程的日志经共享内存转交
+        //ring_size为每个进程的环大小，所有进程必须一致
+        bool set_shared(cpchar name, size_t ring_size = SHM_RING);
+        //每个线程保留最近的低级别日志(含被过滤的)，出现trigger及以上级别的日志时回放到feature目标
+        //capacity为每个线程的记录字节数，为0时关闭；需在option之后开启，之前调用返回false
+        bool set_flight_recorder(cpchar feature, size_t capacity = RECORD_SIZE, log_level level = log_level::LOG_LEVEL_INFO, log_level trigger = log_level::LOG_LEVEL_ERROR);
+        std::array<size_t, 7> get_drop_stats() const { return overflow_->drops(); }
+        log_stats get_stats();
+        void set_limit(limit_type type, cpchar key, double rate, size_t burst = 0, size_t sample = 0) { limiter_->set_limit(type, key, rate, burst, sample); }
         void set_rolling_type(rolling_type type) { rolling_type_ = type; }
-        void set_clean_time(size_t clean_time) { clean_time_ = clean_time; }
+        void set_clean_time(size_t clean_time) { clean_policy_.clean_time = clean_time; }
+        void set_clean_count(size_t clean_count) { clean_policy_.clean_count = clean_count; }
+        void set_clean_size(size_t clean_size) { clean_policy_.clean_size = clean_size; }
+        void set_compress(int level, size_t threads = 1, size_t queue_size = QUEUE_SIZE) { cleaner_->compressor()->option(level, threads, queue_size); }
+        compress_stats get_compress_stats() const { return cleaner_->compressor()->stats(); }
         void set_dest_clean_time(cpchar feature, size_t clean_time);
 
+        //把目标切换为异步阶段，相同worker编号的阶段共享一个线程
+        //feature为"stdio"时对应控制台，"main"对应主日志
+        bool set_dest_async(cpchar feature, size_t worker);
+        bool set_lvl_async(log_level log_lvl, size_t worker);
+        std::map<sstring, stage_stats> get_stage_stats();
+
     protected:
         path build_path(cpchar feature);
-        void flush();
+        sptr<log_stage> make_stage(sptr<log_dest>& dest, cpchar name, size_t worker);
+        bool set_backend(sptr<log_dest> dest, io_backend backend, size_t sync_ms);
+        bool set_index(sptr<log_dest> dest, bool on);
+        //持有mutex_时调用，按当前配置发布新的路由快照
+        void publish();
+        void flush(const log_routes& routes);
         void run();
+        void dispatch(const log_routes& routes, sptr<log_message> logmsg);
+        void report(const log_routes& routes, bool force);
+        bool collect(const log_routes& routes);
+        static void on_crash(int sig);
+        void crash_dump(int sig);
+        void crash_write(vstring data, bool flush = false);
 
         path            log_path_;
         spin_mutex      mutex_;
+        std::mutex      dispatch_mutex_;    //路由线程和同步写入互斥，持有期间有磁盘IO
+        std::atomic<size_t> sync_waiters_ = 0; //等待dispatch_mutex_的同步写入数
+        sptr<log_waker> waker_ = std::make_shared<log_waker>();
+        sptr<log_overflow> overflow_ = std::make_shared<log_overflow>();
+        sptr<log_limiter> limiter_ = std::make_shared<log_limiter>();
+        sptr<log_flight> flight_ = std::make_shared<log_flight>();
+        log_histogram   latency_, loop_;
         std::thread     thread_;
         sstring         service_;
+        sptr<stdio_dest> stdio_ = std::make_shared<stdio_dest>();
         sptr<log_dest>  std_dest_ = nullptr;
         sptr<log_dest>  main_dest_ = nullptr;
         std::map<uint64_t, sptr<log_agent>> agents_;
         std::map<log_level, sptr<log_dest>> dest_lvls_;
         std::map<sstring, sptr<log_dest>, std::less<>> dest_features_;
-        size_t max_size_ = MAX_SIZE, clean_time_ = CLEAN_TIME;
+        std::map<sstring, sptr<log_stage>, std::less<>> stages_;
+        std::map<log_level, sptr<log_stage>> lvl_stages_;
+        std::map<size_t, sptr<log_stage_worker>> workers_;
+        sptr<log_routes> routes_ = std::make_shared<log_routes>();
+        sptr<log_routes> crash_keep_ = nullptr;
+        std::atomic<log_routes*> crash_routes_ = nullptr;
+#ifndef WIN32
+        sptr<log_shm>   shm_ = nullptr;
+        sptr<log_messages> shm_msgs_ = std::make_shared<log_messages>();
+        sptr<log_message_pool> shm_pool_ = std::make_shared<log_message_pool>();
+#endif
+        std::unique_ptr<char[]> crash_buf_;
+        std::unique_ptr<char[]> crash_stack_;  //信号处理的备用栈，栈溢出时仍可导出
+        size_t crash_size_ = 0;
+        int crash_fd_ = -1;
+        size_t max_size_ = MAX_SIZE, queue_size_ = QUEUE_SIZE, chunk_size_ = CHUNK_SIZE;
+        clean_policy clean_policy_;
+        sptr<log_cleaner> cleaner_ = std::make_shared<log_cleaner>();
         rolling_type rolling_type_ = rolling_type::DAYLY;
+        std::atomic_bool running_ = false;
         bool log_daemon_ = false;
-        bool running_ = false;
     }; // class log_service
 }
 
@@ -8,11 +8,205 @@ using namespace luakit;
 namespace logger {
 
     thread_local std::shared_ptr<log_agent> s_agent = make_shared<log_agent>();
+    thread_local bool s_deferred = false;
+    //source限流取调用位置的栈层级，1为调用日志函数处，经lua封装函数调用时需加上封装的层数
+    thread_local int s_source_level = 1;
     static std::shared_ptr<log_service> s_logger = make_shared<log_service>();
 
     const int LOG_FLAG_FORMAT = 1;
     const int LOG_FLAG_PRETTY = 2;
     const int LOG_FLAG_MONITOR = 4;
+
+    //table序列化限制，超出时截断并追加标记
+    const size_t TABLE_DEPTH = 32;
+    struct table_limit {
+        size_t depth = 8;           //最大嵌套层数，不超过TABLE_DEPTH
+        size_t count = 1024;        //最多输出的元素数
+        size_t bytes = 65536;       //最大字节数
+    };
+    thread_local table_limit s_table_limit;
+    const vstring TABLE_TRUNCATED = "...<truncated>";
+
+    //序列化过程中lua可能抛出错误跳过c++栈帧，writer只使用不需要析构的成员
+    struct table_writer {
+        lua_State* L;
+        sstring& out;
+        bool pretty;
+        size_t start = 0;
+        size_t count = 0;
+        bool truncated = false;
+        size_t depth = 0;
+        const void* path[TABLE_DEPTH];  //当前路径上的table，用于检测环
+    };
+
+    void write_indent(table_writer& w, size_t depth) {
+        if (w.pretty) {
+            w.out.push_back('\n');
+            w.out.append(depth * 4, ' ');
+        }
+    }
+
+    int tostring_call(lua_State* L) {
+        luaL_tolstring(L, 1, nullptr);
+        return 1;
+    }
+
+    //非字符串和数字的值转换为字符串，__tostring在保护模式下调用，出错时输出标记
+    void write_tostring(table_writer& w, int index) {
+        lua_State* L = w.L;
+        index = lua_absindex(L, index);
+        lua_pushcfunction(L, tostring_call);
+        lua_pushvalue(L, index);
+        if (lua_pcall(L, 1, 1, 0) != LUA_OK) {
+            w.out.append("<tostring error>");
+            lua_pop(L, 1);
+            return;
+        }
+        size_t len;
+        const char* buf = lua_tolstring(L, -1, &len);
+        w.out.append(buf, len);
+        lua_pop(L, 1);
+    }
+
+    //字符串按lua字面量转义，输出可以被lua读回
+    void write_string(table_writer& w, const char* buf, size_t len) {
+        w.out.push_back('"');
+        const char* end = buf + len;
+        while (buf < end) {
+            const char* it = std::find_if(buf, end, [](unsigned char c) { return c < 0x20 || c == '"' || c == '\\' || c == 0x7F; });
+            w.out.append(buf, it);
+            if (it == end) break;
+            unsigned char c = *it;
+            switch (c) {
+            case '"': w.out.append("\\\""); break;
+            case '\\': w.out.append("\\\\"); break;
+            case '\n': w.out.append("\\n"); break;
+            case '\r': w.out.append("\\r"); break;
+            case '\t': w.out.append("\\t"); break;
+            default: fmt::format_to(std::back_inserter(w.out), "\\{:03d}", c); break;
+            }
+            buf = it + 1;
+        }
+        w.out.push_back('"');
+    }
+
+    bool is_name(vstring key) {
+        if (key.empty() || isdigit((unsigned char)key[0])) return false;
+        return std::all_of(key.begin(), key.end(), [](char c) { return isalnum((unsigned char)c) || c == '_'; });
+    }
+
+    void write_key(table_writer& w, int index) {
+        switch (lua_type(w.L, index)) {
+        case LUA_TSTRING: {
+            size_t len;
+            const char* buf = lua_tolstring(w.L, index, &len);
+            if (is_name(vstring(buf, len))) {
+                w.out.append(buf, len);
+                return;
+            }
+            w.out.push_back('[');
+            write_string(w, buf, len);
+            w.out.push_back(']');
+            return;
+        }
+        case LUA_TNUMBER:
+            //不能对键调用lua_tolstring，会改变键的类型
+            if (lua_isinteger(w.L, index)) {
+                fmt::format_to(std::back_inserter(w.out), "[{}]", lua_tointeger(w.L, index));
+                return;
+            }
+            fmt::format_to(std::back_inserter(w.out), "[{}]", lua_tonumber(w.L, index));
+            return;
+        default:
+            w.out.push_back('[');
+            write_tostring(w, index);
+            w.out.push_back(']');
+        }
+    }
+
+    void write_value(table_writer& w, int index, size_t depth);
+    void write_table(table_writer& w, int index, size_t depth) {
+        lua_State* L = w.L;
+        index = lua_absindex(L, index);
+        if (luaL_getmetafield(L, index, "__tostring") != LUA_TNIL) {
+            lua_pop(L, 1);
+            write_tostring(w, index);
+            return;
+        }
+        const void* table = lua_topointer(L, index);
+        if (std::find(w.path, w.path + w.depth, table) != w.path + w.depth) {
+            w.out.append("<cycle>");
+            return;
+        }
+        //每层占用键、值和__tostring调用的栈槽，栈不足时按截断处理
+        if (depth >= std::min(s_table_limit.depth, TABLE_DEPTH) || !lua_checkstack(L, 4)) {
+            w.out.append("{...}");
+            return;
+        }
+        w.path[w.depth++] = table;
+        w.out.push_back('{');
+        bool empty = true;
+        lua_Integer next = 1;
+        lua_pushnil(L);
+        while (lua_next(L, index)) {
+            if (w.truncated || w.out.size() - w.start >= s_table_limit.bytes || w.count >= s_table_limit.count) {
+                w.truncated = true;
+                lua_pop(L, 2);
+                break;
+            }
+            ++w.count;
+            if (!empty) w.out.push_back(',');
+            empty = false;
+            write_indent(w, depth + 1);
+            //从1开始连续的整数键按数组输出
+            if (next > 0 && lua_type(L, -2) == LUA_TNUMBER && lua_isinteger(L, -2) && lua_tointeger(L, -2) == next) {
+                ++next;
+            } else {
+                next = 0;
+                write_key(w, -2);
+                w.out.push_back('=');
+            }
+            write_value(w, -1, depth + 1);
+            lua_pop(L, 1);
+        }
+        --w.depth;
+        if (!empty) write_indent(w, depth);
+        w.out.push_back('}');
+    }
+
+    void write_value(table_writer& w, int index, size_t depth) {
+        switch (lua_type(w.L, index)) {
+        case LUA_TNIL: w.out.append("nil"); break;
+        case LUA_TBOOLEAN: w.out.append(lua_toboolean(w.L, index) ? "true" : "false"); break;
+        case LUA_TTABLE: write_table(w, index, depth); break;
+        case LUA_TSTRING: {
+            size_t len;
+            const char* buf = lua_tolstring(w.L, index, &len);
+            write_string(w, buf, len);
+            break;
+        }
+        case LUA_TNUMBER:
+            if (lua_isinteger(w.L, index)) {
+                fmt::format_to(std::back_inserter(w.out), "{}", lua_tointeger(w.L, index));
+                break;
+            }
+            fmt::format_to(std::back_inserter(w.out), "{}", lua_tonumber(w.L, index));
+            break;
+        default: write_tostring(w, index); break;
+        }
+    }
+
+    //table直接序列化追加到out，不经过中间缓冲
+    vstring read_table(lua_State* L, int flag, int index, sstring& out) {
+        table_writer w { L, out, (flag & LOG_FLAG_PRETTY) == LOG_FLAG_PRETTY, out.size() };
+        write_table(w, index, 0);
+        if (w.truncated || out.size() - w.start > s_table_limit.bytes) {
+            out.resize(std::min(out.size(), w.start + s_table_limit.bytes));
+            out.append(TABLE_TRUNCATED);
+        }
+        return vstring(out).substr(w.start);
+    }
+
     string read_args(lua_State* L, int flag, int index) {
         switch (lua_type(L, index)) {
         case LUA_TNIL: return "nil";
@@ -28,10 +222,9 @@ namespace logger {
         }
         case LUA_TTABLE:
             if ((flag & LOG_FLAG_FORMAT) == LOG_FLAG_FORMAT) {
-                auto buf = luakit::get_buff();
-                buf->clean();
-                serialize_one(L, buf, index, 1, (flag & LOG_FLAG_PRETTY) == LOG_FLAG_PRETTY);
-                return string((char*)buf->head(), buf->size());
+                string out;
+                read_table(L, flag, index, out);
+                return out;
             }
             return luaL_tolstring(L, index, nullptr);
         case LUA_TNUMBER:
@@ -43,32 +236,210 @@ namespace logger {
         return "unsuppert data type";
     }
 
-    int zformat(lua_State* L, log_level lvl, cpchar tag, cpchar feature, int flag, sstring&& msg) {
+    void defer_args(lua_State* L, sptr<log_message>& logmsg, int flag, int index) {
+        switch (lua_type(L, index)) {
+        case LUA_TBOOLEAN: logmsg->push_arg((bool)lua_toboolean(L, index)); break;
+        case LUA_TSTRING: {
+            size_t len;
+            const char* buf = lua_tolstring(L, index, &len);
+            logmsg->push_arg(vstring(buf, len));
+            break;
+        }
+        case LUA_TNUMBER:
+            if (lua_isinteger(L, index)) {
+                logmsg->push_arg((int64_t)lua_tointeger(L, index));
+            } else {
+                logmsg->push_arg((double)lua_tonumber(L, index));
+            }
+            break;
+        case LUA_TTABLE:
+            //table必须在当前线程读取，序列化后只复制一次到日志
+            if ((flag & LOG_FLAG_FORMAT) == LOG_FLAG_FORMAT) {
+                thread_local sstring t_table;
+                t_table.clear();
+                logmsg->push_arg(read_table(L, flag, index, t_table));
+                break;
+            }
+            logmsg->push_arg(vstring(read_args(L, flag, index)));
+            break;
+        default: {
+            //其他类型必须在当前线程读取，转成字符串记录
+            auto arg = read_args(L, flag, index);
+            logmsg->push_arg(vstring(arg));
+            break;
+        }
+        }
+    }
+
+    //延迟格式化：参数以二进制记录，由日志线程格式化
+    int dformat(lua_State* L, log_level lvl, cpchar tag, cpchar feature, int flag, cpchar vfmt, int index) {
+        auto logmsg = s_agent->allocate();
+        logmsg->defer(lvl, vfmt, tag, feature, "", 0);
+        int top = lua_gettop(L);
+        for (int i = index; i <= top; ++i) {
+            defer_args(L, logmsg, flag, i);
+        }
+        s_agent->push(logmsg);
+        return 0;
+    }
+
+    //被过滤的日志写入飞行记录，参数以二进制记录，回放时才格式化
+    int rformat(lua_State* L, log_level lvl, cpchar tag, cpchar feature, int flag, cpchar vfmt, int index) {
+        int top = lua_gettop(L);
+        if (top < index) {
+            s_agent->record(lvl, vfmt, tag);
+            return 0;
+        }
+        thread_local sptr<log_message> t_logmsg = std::make_shared<log_message>();
+        t_logmsg->defer(lvl, vfmt, tag, feature, "", 0);
+        for (int i = index; i <= top; ++i) {
+            defer_args(L, t_logmsg, flag, i);
+        }
+        s_agent->record(*t_logmsg);
+        return 0;
+    }
+
+    //格式化中的table参数缓冲，deque扩展时已有缓冲的地址不变
+    thread_local std::deque<sstring> t_tables;
+    thread_local size_t t_table_count = 0;
+
+    void push_args(lua_State* L, fmt::dynamic_format_arg_store<fmt::format_context>& args, int flag, int index) {
+        switch (lua_type(L, index)) {
+        case LUA_TBOOLEAN: args.push_back((bool)lua_toboolean(L, index)); break;
+        case LUA_TSTRING: {
+            size_t len;
+            const char* buf = lua_tolstring(L, index, &len);
+            args.push_back(fmt::string_view(buf, len));
+            break;
+        }
+        case LUA_TNUMBER:
+            if (lua_isinteger(L, index)) {
+                args.push_back((int64_t)lua_tointeger(L, index));
+            } else {
+                args.push_back((double)lua_tonumber(L, index));
+            }
+            break;
+        case LUA_TTABLE:
+            if ((flag & LOG_FLAG_FORMAT) == LOG_FLAG_FORMAT) {
+                //按视图传给fmt，不再复制
+                if (t_table_count == t_tables.size()) t_tables.emplace_back();
+                auto& out = t_tables[t_table_count++];
+                out.clear();
+                auto table = read_table(L, flag, index, out);
+                args.push_back(fmt::string_view(table.data(), table.size()));
+                break;
+            }
+            args.push_back(read_args(L, flag, index));
+            break;
+        default: args.push_back(read_args(L, flag, index)); break;
+        }
+    }
+
+    //按缓存的预解析格式串格式化index开始的参数，结果在线程缓冲中
+    vstring lformat(lua_State* L, int flag, cpchar vfmt, int index) {
+        thread_local fmt::memory_buffer t_buf;
+        thread_local fmt::dynamic_format_arg_store<fmt::format_context> t_args;
+        t_buf.clear();
+        t_args.clear();
+        t_table_count = 0;
+        int top = lua_gettop(L);
+        for (int i = index; i <= top; ++i) {
+            push_args(L, t_args, flag, i);
+        }
+        log_format::find(vfmt).format(t_buf, t_args);
+        return vstring(t_buf.data(), t_buf.size());
+    }
+
+    int zformat(lua_State* L, log_level lvl, cpchar tag, cpchar feature, int flag, vstring msg) {
         if ((flag & LOG_FLAG_MONITOR) == LOG_FLAG_MONITOR) {
-            lua_pushlstring(L, msg.c_str(), msg.size());
-            s_agent->output(lvl, std::move(msg), tag, feature);
+            lua_pushlstring(L, msg.data(), msg.size());
+            s_agent->commit(lvl, msg, tag, feature);
             return 1;
         }
-        s_agent->output(lvl, std::move(msg), tag, feature);
+        s_agent->commit(lvl, msg, tag, feature);
         return 0;
     }
 
-    template<size_t... integers>
-    int tformat(lua_State* L, log_level lvl, cpchar tag, cpchar feature, int flag, cpchar vfmt, std::index_sequence<integers...>&&) {
+    //限流检查在格式化之前，只有配置了source规则时才读取调用位置
+    bool limited(lua_State* L, cpchar tag, cpchar feature) {
+        if (!s_agent->limiting()) return false;
+        lua_Debug ar;
+        if (s_agent->limiting_source() && lua_getstack(L, s_source_level, &ar) && lua_getinfo(L, "Sl", &ar)) {
+            return s_agent->limited(tag, feature, ar.short_src, ar.currentline);
+        }
+        return s_agent->limited(tag, feature, "", 0);
+    }
+
+    int tformat(lua_State* L, log_level lvl, cpchar tag, cpchar feature, int flag, cpchar vfmt, int index) {
         try {
-            auto msg = fmt::format(vfmt, read_args(L, flag, integers + 6)...);
-            return zformat(L, lvl, tag, feature, flag, std::move(msg));
+            auto msg = lformat(L, flag, vfmt, index);
+            return zformat(L, lvl, tag, feature, flag, msg);
         } catch (const exception& e) {
             luaL_error(L, "log format failed: %s!", e.what());
         }
         return 0;
     }
 
-    template<size_t... integers>
-    int fformat(lua_State* L, int flag, cpchar vfmt, std::index_sequence<integers...>&&) {
+    //vfmt之后从index开始为参数，filtered表示只写入飞行记录
+    int lprint(lua_State* L, log_level lvl, int flag, cpchar tag, cpchar feature, cpchar vfmt, int index, bool filtered) {
+        if (filtered) {
+            return rformat(L, lvl, tag, feature, flag, vfmt, index);
+        }
+        if ((flag & LOG_FLAG_MONITOR) == 0 && limited(L, tag, feature)) return 0;
+        int arg_num = lua_gettop(L) - index + 1;
+        if (s_deferred && arg_num > 0 && (flag & LOG_FLAG_MONITOR) == 0) {
+            return dformat(L, lvl, tag, feature, flag, vfmt, index);
+        }
+        if (arg_num == 0) {
+            return zformat(L, lvl, tag, feature, flag, vfmt);
+        }
+        return tformat(L, lvl, tag, feature, flag, vfmt, index);
+    }
+
+    //按级别特化的日志函数，flag/tag/feature为上值，被过滤时不读取任何参数
+    template <log_level LVL>
+    int lprint(lua_State* L) {
+        bool filtered = s_agent->is_filter(LVL);
+        if (filtered && !s_agent->recording(LVL)) return 0;
+        int flag = (int)lua_tointeger(L, lua_upvalueindex(1));
+        cpchar tag = lua_to_native<cpchar>(L, lua_upvalueindex(2));
+        cpchar feature = lua_to_native<cpchar>(L, lua_upvalueindex(3));
+        cpchar vfmt = lua_to_native<cpchar>(L, 1);
+        return lprint(L, LVL, flag, tag, feature, vfmt, 2, filtered);
+    }
+
+    //在栈顶的表中生成debug/info/...函数
+    void push_printers(lua_State* L, int flag, cpchar tag, cpchar feature) {
+        static const std::array<std::pair<cpchar, lua_CFunction>, 6> printers = { {
+            { "debug", lprint<log_level::LOG_LEVEL_DEBUG> },
+            { "info", lprint<log_level::LOG_LEVEL_INFO> },
+            { "warn", lprint<log_level::LOG_LEVEL_WARN> },
+            { "dump", lprint<log_level::LOG_LEVEL_DUMP> },
+            { "error", lprint<log_level::LOG_LEVEL_ERROR> },
+            { "fatal", lprint<log_level::LOG_LEVEL_FATAL> },
+        } };
+        for (auto& [name, printer] : printers) {
+            lua_pushinteger(L, flag);
+            lua_pushstring(L, tag);
+            lua_pushstring(L, feature);
+            lua_pushcclosure(L, printer, 3);
+            lua_setfield(L, -2, name);
+        }
+    }
+
+    //各级别是否输出，lua热点代码先检查再构造参数
+    //enabled表不存值，由__index读取当前agent的过滤状态，C++侧调用filter也能立即反映
+    int enabled_index(lua_State* L) {
+        lua_Integer lv = lua_tointeger(L, 2);
+        bool enabled = lv >= (lua_Integer)log_level::LOG_LEVEL_DEBUG && lv <= (lua_Integer)log_level::LOG_LEVEL_FATAL;
+        lua_pushboolean(L, enabled && !s_agent->is_filter((log_level)lv));
+        return 1;
+    }
+
+    int fformat(lua_State* L, int flag, cpchar vfmt) {
         try {
-            auto msg = fmt::format(vfmt, read_args(L, flag, integers + 2)...);
-            lua_pushlstring(L, msg.c_str(), msg.size());
+            auto msg = lformat(L, flag, vfmt, 2);
+            lua_pushlstring(L, msg.data(), msg.size());
             return 1;
         } catch (const exception& e) {
             luaL_error(L, "log format failed: %s!", e.what());
@@ -76,6 +447,92 @@ namespace logger {
         return 0;
     }
 
+    void push_histogram(lua_State* L, const histogram_stats& histogram) {
+        lua_createtable(L, 0, 4);
+        lua_pushinteger(L, histogram.count); lua_setfield(L, -2, "count");
+        lua_pushinteger(L, histogram.sum); lua_setfield(L, -2, "sum");
+        lua_pushinteger(L, histogram.max); lua_setfield(L, -2, "max");
+        lua_createtable(L, histogram.buckets.size(), 0);
+        for (size_t i = 0; i < histogram.buckets.size(); ++i) {
+            lua_pushinteger(L, histogram.buckets[i]);
+            lua_rawseti(L, -2, i + 1);
+        }
+        lua_setfield(L, -2, "buckets");
+    }
+
+    int push_stats(lua_State* L) {
+        auto stats = s_logger->get_stats();
+        lua_createtable(L, 0, 5);
+        lua_createtable(L, 0, stats.agents.size());
+        for (auto& [id, agent] : stats.agents) {
+            lua_createtable(L, 0, 4);
+            lua_pushinteger(L, agent.depth); lua_setfield(L, -2, "depth");
+            lua_pushinteger(L, agent.capacity); lua_setfield(L, -2, "capacity");
+            lua_pushinteger(L, agent.messages); lua_setfield(L, -2, "messages");
+            lua_pushinteger(L, agent.refills); lua_setfield(L, -2, "refills");
+            lua_rawseti(L, -2, id);
+        }
+        lua_setfield(L, -2, "agents");
+        lua_createtable(L, 0, stats.dests.size());
+        for (auto& [name, dest] : stats.dests) {
+            lua_createtable(L, 0, 5);
+            lua_pushinteger(L, dest.messages); lua_setfield(L, -2, "messages");
+            lua_pushinteger(L, dest.bytes); lua_setfield(L, -2, "bytes");
+            lua_pushinteger(L, dest.remaps); lua_setfield(L, -2, "remaps");
+            lua_pushinteger(L, dest.rotations); lua_setfield(L, -2, "rotations");
+            lua_pushinteger(L, dest.rotate_us); lua_setfield(L, -2, "rotate_us");
+            lua_setfield(L, -2, name.c_str());
+        }
+        lua_setfield(L, -2, "dests");
+        push_histogram(L, stats.latency);
+        lua_setfield(L, -2, "latency");
+        push_histogram(L, stats.loop);
+        lua_setfield(L, -2, "loop");
+        auto names = level_names<log_level>()();
+        lua_createtable(L, 0, stats.drops.size());
+        for (size_t i = 1; i < stats.drops.size(); ++i) {
+            lua_pushinteger(L, stats.drops[i]);
+            lua_setfield(L, -2, names[i]);
+        }
+        lua_setfield(L, -2, "drops");
+        return 1;
+    }
+
+    //query(log_path, from, to, levels, limit)：from/to为秒，levels为级别列表，返回匹配的日志行
+    int query_lines(lua_State* L) {
+        cpchar log_path = luaL_checkstring(L, 1);
+        int64_t from = (int64_t)(lua_tonumber(L, 2) * 1000000);
+        int64_t to = lua_isnoneornil(L, 3) ? INT64_MAX : (int64_t)(lua_tonumber(L, 3) * 1000000);
+        uint32_t levels = 0;
+        if (lua_type(L, 4) == LUA_TTABLE) {
+            for (int i = 1; lua_rawgeti(L, 4, i) != LUA_TNIL; ++i) {
+                lua_Integer lv = lua_tointeger(L, -1);
+                if (!lua_isinteger(L, -1) || lv < (int)log_level::LOG_LEVEL_DEBUG || lv > (int)log_level::LOG_LEVEL_FATAL) {
+                    return luaL_argerror(L, 4, "invalid log level");
+                }
+                levels |= 1 << lv;
+                lua_pop(L, 1);
+            }
+            lua_pop(L, 1);
+        }
+        lua_Integer limit = luaL_optinteger(L, 5, 1000);
+        luaL_argcheck(L, limit >= 0, 5, "limit must not be negative");
+        //先收集到vector，查询返回后再压栈，避免lua内存错误跳过查询中的C++栈帧
+        std::vector<sstring> lines;
+        if (limit > 0) {
+            log_index::query(log_path, from, to, levels, [&](vstring line) {
+                lines.emplace_back(line);
+                return lines.size() < (size_t)limit;
+            });
+        }
+        lua_createtable(L, (int)lines.size(), 0);
+        for (size_t i = 0; i < lines.size(); ++i) {
+            lua_pushlstring(L, lines[i].data(), lines[i].size());
+            lua_rawseti(L, -2, i + 1);
+        }
+        return 1;
+    }
+
     luakit::lua_table open_lualog(lua_State* L) {
         luakit::kit_state kit_state(L);
         auto lualog = kit_state.new_table("log");
@@ -87,6 +544,25 @@ namespace logger {
             "ERROR", log_level::LOG_LEVEL_ERROR,
             "FATAL", log_level::LOG_LEVEL_FATAL
         );
+        lualog.new_enum("WAIT_MODE",
+            "POLL", wait_mode::POLL,
+            "ADAPTIVE", wait_mode::ADAPTIVE
+        );
+        lualog.new_enum("OVERFLOW_POLICY",
+            "BLOCK", overflow_policy::BLOCK,
+            "DROP_NEWEST", overflow_policy::DROP_NEWEST,
+            "DROP_OLDEST", overflow_policy::DROP_OLDEST,
+            "DROP_LEVEL", overflow_policy::DROP_LEVEL
+        );
+        lualog.new_enum("LIMIT_TYPE",
+            "TAG", limit_type::TAG,
+            "FEATURE", limit_type::FEATURE,
+            "SOURCE", limit_type::SOURCE
+        );
+        lualog.new_enum("IO_BACKEND",
+            "MMAP", io_backend::MMAP,
+            "BATCH", io_backend::BATCH
+        );
         lualog.new_enum("LOG_FLAG",
             "NULL", 0,
             "FORMAT", LOG_FLAG_FORMAT,
@@ -95,51 +571,97 @@ namespace logger {
         );
         lualog.set_function("print", [](lua_State* L) {
             log_level lvl = (log_level)lua_tointeger(L, 1);
-            if (s_agent->is_filter(lvl)) return 0;
-            size_t flag = lua_tointeger(L, 2);
+            bool filtered = s_agent->is_filter(lvl);
+            if (filtered && !s_agent->recording(lvl)) return 0;
+            int flag = (int)lua_tointeger(L, 2);
             cpchar tag = lua_to_native<cpchar>(L, 3);
             cpchar feature = lua_to_native<cpchar>(L, 4);
             cpchar vfmt = lua_to_native<cpchar>(L, 5);
-            int arg_num = lua_gettop(L) - 5;
-            switch (arg_num) {
-            case 0: return zformat(L, lvl, tag, feature, flag, string(vfmt));
-            case 1: return tformat(L, lvl, tag, feature, flag, vfmt, make_index_sequence<1>{});
-            case 2: return tformat(L, lvl, tag, feature, flag, vfmt, make_index_sequence<2>{});
-            case 3: return tformat(L, lvl, tag, feature, flag, vfmt, make_index_sequence<3>{});
-            case 4: return tformat(L, lvl, tag, feature, flag, vfmt, make_index_sequence<4>{});
-            case 5: return tformat(L, lvl, tag, feature, flag, vfmt, make_index_sequence<5>{});
-            case 6: return tformat(L, lvl, tag, feature, flag, vfmt, make_index_sequence<6>{});
-            case 7: return tformat(L, lvl, tag, feature, flag, vfmt, make_index_sequence<7>{});
-            case 8: return tformat(L, lvl, tag, feature, flag, vfmt, make_index_sequence<8>{});
-            case 9: return tformat(L, lvl, tag, feature, flag, vfmt, make_index_sequence<9>{});
-            case 10: return tformat(L, lvl, tag, feature, flag, vfmt, make_index_sequence<10>{});
-            default: luaL_error(L, "print args is more than 10!"); break;
-            }
-            return 0;
+            return lprint(L, lvl, flag, tag, feature, vfmt, 6, filtered);
+        });
+        lualog.set_function("logger", [](lua_State* L) {
+            cpchar tag = luaL_optstring(L, 1, "");
+            cpchar feature = luaL_optstring(L, 2, "");
+            int flag = (int)luaL_optinteger(L, 3, 0);
+            lua_createtable(L, 0, 6);
+            push_printers(L, flag, tag, feature);
+            return 1;
         });
         lualog.set_function("format", [](lua_State* L) {
             cpchar vfmt = lua_to_native<cpchar>(L, 1);
             int arg_num = lua_gettop(L) - 1;
-            switch (arg_num) {
-            case 0: lua_pushstring(L, vfmt); return 1;
-            case 1: return fformat(L, LOG_FLAG_FORMAT, vfmt, make_index_sequence<1>{});
-            case 2: return fformat(L, LOG_FLAG_FORMAT, vfmt, make_index_sequence<2>{});
-            case 3: return fformat(L, LOG_FLAG_FORMAT, vfmt, make_index_sequence<3>{});
-            case 4: return fformat(L, LOG_FLAG_FORMAT, vfmt, make_index_sequence<4>{});
-            case 5: return fformat(L, LOG_FLAG_FORMAT, vfmt, make_index_sequence<5>{});
-            case 6: return fformat(L, LOG_FLAG_FORMAT, vfmt, make_index_sequence<6>{});
-            case 7: return fformat(L, LOG_FLAG_FORMAT, vfmt, make_index_sequence<7>{});
-            case 8: return fformat(L, LOG_FLAG_FORMAT, vfmt, make_index_sequence<8>{});
-            case 9: return fformat(L, LOG_FLAG_FORMAT, vfmt, make_index_sequence<9>{});
-            case 10: return fformat(L, LOG_FLAG_FORMAT, vfmt, make_index_sequence<10>{});
-            default: luaL_error(L, "format args is more than 10!"); break;
+            if (arg_num == 0) {
+                lua_pushstring(L, vfmt);
+                return 1;
             }
-            return 0;
+            return fformat(L, LOG_FLAG_FORMAT, vfmt);
         });
 
+        lualog.set_function("compress_stats", [](lua_State* L) {
+            auto stats = s_logger->get_compress_stats();
+            lua_createtable(L, 0, 7);
+            lua_pushinteger(L, stats.pending); lua_setfield(L, -2, "pending");
+            lua_pushinteger(L, stats.finished); lua_setfield(L, -2, "finished");
+            lua_pushinteger(L, stats.dropped); lua_setfield(L, -2, "dropped");
+            lua_pushinteger(L, stats.failed); lua_setfield(L, -2, "failed");
+            lua_pushinteger(L, stats.bytes_in); lua_setfield(L, -2, "bytes_in");
+            lua_pushinteger(L, stats.bytes_out); lua_setfield(L, -2, "bytes_out");
+            lua_pushinteger(L, stats.cost_ms); lua_setfield(L, -2, "cost_ms");
+            return 1;
+        });
+        lualog.set_function("stage_stats", [](lua_State* L) {
+            auto stats = s_logger->get_stage_stats();
+            lua_createtable(L, 0, stats.size());
+            for (auto& [name, stage] : stats) {
+                lua_createtable(L, 0, 5);
+                lua_pushinteger(L, stage.pending); lua_setfield(L, -2, "pending");
+                lua_pushinteger(L, stage.written); lua_setfield(L, -2, "written");
+                lua_pushinteger(L, stage.stalls); lua_setfield(L, -2, "stalls");
+                lua_pushinteger(L, stage.lag_us); lua_setfield(L, -2, "lag_us");
+                lua_pushinteger(L, stage.max_lag_us); lua_setfield(L, -2, "max_lag_us");
+                lua_setfield(L, -2, name.c_str());
+            }
+            return 1;
+        });
+        lualog.set_function("stats", [](lua_State* L) { return push_stats(L); });
+        lualog.set_function("query", [](lua_State* L) { return query_lines(L); });
+        lualog.set_function("drop_stats", [](lua_State* L) {
+            auto drops = s_logger->get_drop_stats();
+            auto names = level_names<log_level>()();
+            lua_createtable(L, 0, drops.size());
+            for (size_t i = 1; i < drops.size(); ++i) {
+                lua_pushinteger(L, drops[i]);
+                lua_setfield(L, -2, names[i]);
+            }
+            return 1;
+        });
+        lualog.set_function("set_overflow_policy", [](overflow_policy policy, int lv) { s_logger->set_overflow_policy(policy, (log_level)lv); });
+        lualog.set_function("set_limit", [](limit_type type, cpchar key, double rate, size_t burst, size_t sample) { s_logger->set_limit(type, key, rate, burst, sample); });
+        lualog.set_function("set_source_level", [](int level) { s_source_level = std::max(1, level); });
+        lualog.set_function("set_global_capacity", [](size_t capacity) { s_logger->set_global_capacity(capacity); });
+        lualog.set_function("set_dest_async", [](cpchar feature, size_t worker) { return s_logger->set_dest_async(feature, worker); });
+        lualog.set_function("set_dest_backend", [](cpchar feature, io_backend backend, size_t sync_ms) { return s_logger->set_dest_backend(feature, backend, sync_ms); });
+        lualog.set_function("set_dest_index", [](cpchar feature, bool on) { return s_logger->set_dest_index(feature, on); });
+        lualog.set_function("set_lvl_index", [](int lv, bool on) { return s_logger->set_lvl_index((log_level)lv, on); });
+        lualog.set_function("set_lvl_backend", [](int lv, io_backend backend, size_t sync_ms) { return s_logger->set_lvl_backend((log_level)lv, backend, sync_ms); });
+        lualog.set_function("set_lvl_async", [](int lv, size_t worker) { return s_logger->set_lvl_async((log_level)lv, worker); });
+        lualog.set_function("set_compress", [](int level, size_t threads, size_t queue_size) { s_logger->set_compress(level, threads, queue_size); });
         lualog.set_function("daemon", [](bool status) { s_logger->daemon(status); });
+        lualog.set_function("set_stderr", [](bool on) { s_logger->set_stderr(on); });
+        lualog.set_function("set_sync_level", [](log_level lvl) { s_logger->set_sync_level(lvl); });
+        lualog.set_function("install_crash_handler", []() { return s_logger->install_crash_handler(); });
+        lualog.set_function("set_shared", [](cpchar name, size_t ring_size) { return s_logger->set_shared(name, ring_size); });
+        lualog.set_function("set_flight_recorder", [](cpchar feature, size_t capacity, log_level lvl, log_level trigger) { return s_logger->set_flight_recorder(feature, capacity, lvl, trigger); });
         lualog.set_function("set_max_size", [](size_t size) { s_logger->set_max_size(size); });
+        lualog.set_function("set_chunk_size", [](size_t size) { s_logger->set_chunk_size(size); });
+        lualog.set_function("set_queue_size", [](size_t size) { s_logger->set_queue_size(size); });
+        lualog.set_function("set_wait_delay", [](size_t delay) { s_logger->set_wait_delay(delay); });
+        lualog.set_function("set_wait_mode", [](wait_mode mode) { s_logger->set_wait_mode(mode); });
         lualog.set_function("set_clean_time", [](size_t time) { s_logger->set_clean_time(time); });
+        lualog.set_function("set_clean_size", [](size_t size) { s_logger->set_clean_size(size); });
+        lualog.set_function("set_clean_count", [](size_t count) { s_logger->set_clean_count(count); });
+        lualog.set_function("set_deferred", [](bool deferred) { s_deferred = deferred; });
+        lualog.set_function("set_table_limit", [](size_t depth, size_t count, size_t bytes) { s_table_limit = { std::min(depth, TABLE_DEPTH), count, bytes }; });
         lualog.set_function("attach", []() { s_agent->attach(s_logger->weak_from_this()); });
         lualog.set_function("filter", [](int lv, bool on) { s_agent->filter((log_level)lv, on); });
         lualog.set_function("is_filter", [](int lv) { return s_agent->is_filter((log_level)lv); });
@@ -151,8 +673,18 @@ namespace logger {
         lualog.set_function("ignore_suffix", [](cpchar feature, bool suffix) { s_logger->ignore_suffix(feature, suffix); });
         lualog.set_function("add_dest", [](cpchar feature) { return s_logger->add_dest(feature); });
         lualog.set_function("add_file_dest", [](cpchar feature, cpchar fname) { return s_logger->add_file_dest(feature, fname); });
+        lualog.set_function("add_json_dest", [](cpchar feature) { return s_logger->add_json_dest(feature); });
         lualog.set_function("set_dest_clean_time", [](cpchar feature, size_t time) { s_logger->set_dest_clean_time(feature, time); });
         lualog.set_function("option", [](cpchar log_path, cpchar service, cpchar index) { s_logger->option(log_path, service, index); });
+        lualog.push_stack();
+        push_printers(L, 0, "", "");
+        lua_createtable(L, 0, 0);
+        lua_createtable(L, 0, 1);
+        lua_pushcfunction(L, enabled_index);
+        lua_setfield(L, -2, "__index");
+        lua_setmetatable(L, -2);
+        lua_setfield(L, -2, "enabled");
+        lua_pop(L, 1);
         return lualog;
     }
 }
@@ -168,6 +700,6 @@ extern "C" {
     }
     
     LUALIB_API void output_logger(logger::log_level level, sstring&& msg, cpchar tag, cpchar feature, cpchar source, int line){
-        logger::s_agent->output(level, std::move(msg), tag, feature, source, line);
+        logger::s_agent->output(level, msg, tag, feature, source, line);
     }
 }
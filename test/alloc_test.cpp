@@ -0,0 +1,41 @@
+//alloc_test.cpp
+//验证日志入队路径在稳定状态下没有堆内存分配
+#include "logger.h"
+
+using namespace logger;
+
+thread_local size_t t_allocs = 0;
+
+void* operator new(size_t size) {
+    ++t_allocs;
+    void* p = malloc(size);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+const size_t TEST_COUNT = 1000;
+
+int main() {
+    auto service = std::make_shared<log_service>();
+    service->option("./alloc_test/", "alloc", "1");
+    service->daemon(true);
+    auto agent = std::make_shared<log_agent>();
+    agent->attach(service);
+
+    //预热：填充消息池和tag/feature/source驻留缓存
+    for (size_t i = 0; i < QUEUE_SIZE * 2; ++i) {
+        agent->output(log_level::LOG_LEVEL_INFO, "warm up message", "tag", "feature", __FILE__, __LINE__);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    t_allocs = 0;
+    for (size_t i = 0; i < TEST_COUNT; ++i) {
+        agent->output(log_level::LOG_LEVEL_INFO, "steady state message", "tag", "feature", __FILE__, __LINE__);
+    }
+    size_t allocs = t_allocs;
+    std::cout << "alloc_test: " << TEST_COUNT << " messages, " << allocs << " allocations" << std::endl;
+    service = nullptr;
+    return allocs == 0 ? 0 : 1;
+}
@@ -0,0 +1,79 @@
+//format_bench.cpp
+//对比旧的格式化路径(参数转字符串+运行时解析格式串)和预解析缓存+动态参数路径
+#include "logger.h"
+
+using namespace logger;
+
+const size_t BENCH_COUNT = 1000000;
+
+using arg_store = fmt::dynamic_format_arg_store<fmt::format_context>;
+
+//模拟lua参数：整数、浮点、字符串轮换
+struct bench_arg {
+    int type;
+    int64_t integer;
+    double number;
+    vstring str;
+};
+
+sstring old_read(const bench_arg& arg) {
+    if (arg.type == 0) return fmt::format("{}", arg.integer);
+    if (arg.type == 1) return fmt::format("{}", arg.number);
+    return sstring(arg.str);
+}
+
+//旧路径按参数个数展开模板，每个参数生成临时字符串
+template<size_t... integers>
+sstring old_format(cpchar vfmt, const std::vector<bench_arg>& args, std::index_sequence<integers...>&&) {
+    return fmt::format(fmt::runtime(vfmt), old_read(args[integers])...);
+}
+
+vstring new_format(cpchar vfmt, const std::vector<bench_arg>& args) {
+    thread_local fmt::memory_buffer t_buf;
+    thread_local arg_store t_args;
+    t_buf.clear();
+    t_args.clear();
+    for (auto& arg : args) {
+        if (arg.type == 0) t_args.push_back(arg.integer);
+        else if (arg.type == 1) t_args.push_back(arg.number);
+        else t_args.push_back(fmt::string_view(arg.str.data(), arg.str.size()));
+    }
+    log_format::find(vfmt).format(t_buf, t_args);
+    return vstring(t_buf.data(), t_buf.size());
+}
+
+template<size_t N>
+void bench(size_t count) {
+    sstring vfmt = "bench";
+    std::vector<bench_arg> args;
+    for (size_t i = 0; i < N; ++i) {
+        vfmt += (i % 4 == 3) ? " {:>6}" : " {}";
+        args.push_back({ (int)(i % 3), (int64_t)i * 1000, i + 0.25, "argument" });
+    }
+    auto expect = old_format(vfmt.c_str(), args, std::make_index_sequence<N>{});
+    if (expect != new_format(vfmt.c_str(), args)) {
+        std::cerr << "format mismatch: " << expect << std::endl;
+        exit(1);
+    }
+    size_t bytes = 0;
+    auto start = steady_clock::now();
+    for (size_t i = 0; i < count; ++i) {
+        bytes += old_format(vfmt.c_str(), args, std::make_index_sequence<N>{}).size();
+    }
+    auto old_cost = duration_cast<duration<double>>(steady_clock::now() - start).count();
+    start = steady_clock::now();
+    for (size_t i = 0; i < count; ++i) {
+        bytes += new_format(vfmt.c_str(), args).size();
+    }
+    auto new_cost = duration_cast<duration<double>>(steady_clock::now() - start).count();
+    std::cerr << fmt::format("args:{:<3} old:{:.1f}ns new:{:.1f}ns speedup:{:.2f}x",
+        N, old_cost * 1e9 / count, new_cost * 1e9 / count, old_cost / new_cost) << std::endl;
+}
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? atoi(argv[1]) : BENCH_COUNT;
+    bench<0>(count);
+    bench<3>(count);
+    bench<12>(count);
+    return 0;
+}
@@ -0,0 +1,61 @@
+//format_test.cpp
+//预解析的log_format与fmt::format逐条对比：输出一致，非法格式抛出相同的错误
+#include "logger.h"
+
+using namespace logger;
+
+using arg_store = fmt::dynamic_format_arg_store<fmt::format_context>;
+
+//参数依次为：整数、浮点、字符串、宽度
+sstring format_fmt(cpchar vfmt) {
+    try {
+        return fmt::format(fmt::runtime(vfmt), int64_t(42), 3.14159, "lua", int64_t(8));
+    } catch (const fmt::format_error& e) {
+        return fmt::format("error: {}", e.what());
+    }
+}
+
+sstring format_log(cpchar vfmt) {
+    arg_store store;
+    store.push_back(int64_t(42));
+    store.push_back(3.14159);
+    store.push_back(fmt::string_view("lua"));
+    store.push_back(int64_t(8));
+    fmt::memory_buffer buf;
+    try {
+        log_format::find(vfmt).format(buf, store);
+    } catch (const fmt::format_error& e) {
+        return fmt::format("error: {}", e.what());
+    }
+    return fmt::to_string(buf);
+}
+
+const char* cases[] = {
+    //纯文本与转义
+    "", "plain text", "{{", "}}", "{{}}", "a{{b}}c", "{{{}}}", "}}{}{{",
+    //自动序号与手动序号
+    "{}", "{} {} {} {}", "x{}y{}z", "{1}{0}", "{0} {0} {1}", "{3}{2}{1}{0}", "{2:>6}|{0:<4}|",
+    //填充、对齐、精度、符号、进制
+    "{:>8}", "{:<8}|", "{:^9}", "{:*^9}", "{:08}", "{:+}", "{:x}", "{:#X}", "{:b}",
+    "{} {:.2f}", "{} {:10.3f}", "{} {:e}", "{} {} {:.2}", "{} {} {:>6}", "{} {} {:-^7}",
+    //嵌套的动态宽度和精度
+    "{:{}}", "{0:{3}}", "{1:{3}.{0}}", "{} {:.{}f}", "{0:>{3}}|{2}",
+    //非法格式
+    "{", "}", "{ ", "a{", "a}b", "{}}", "{{}", "{} {1}", "{0} {}", "{5}", "{} {} {} {} {}",
+    "{name}", "{:d}", "{} {} {:d}", "{:%}", "{0:", "{:{}", "{99999999}", "{-1}",
+};
+
+int main() {
+    size_t failed = 0;
+    for (auto vfmt : cases) {
+        sstring expect = format_fmt(vfmt);
+        sstring result = format_log(vfmt);
+        if (expect != result) {
+            ++failed;
+            std::cout << fmt::format("format \"{}\": expect [{}] result [{}]", vfmt, expect, result) << std::endl;
+        }
+    }
+    size_t total = sizeof(cases) / sizeof(cases[0]);
+    std::cout << fmt::format("format test: {}/{} {}", total - failed, total, failed ? "failed" : "ok") << std::endl;
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,172 @@
+//index_test.cpp
+//稀疏索引查询：按时间和级别跳过块的结果与无索引的整体扫描一致，多行日志的续行随首行输出
+//崩溃后重新打开(末尾有预分配的0，索引缺少最后一块)和开启索引前已有内容的文件，没有索引项的部分也能查到
+//json目标拒绝开启索引
+#include "logger.h"
+
+using namespace logger;
+
+const size_t TEST_LINES = 200000;
+const int64_t TEST_STEP = 10000;    //每条日志间隔10ms
+
+struct query_result {
+    size_t lines = 0, errors = 0, continued = 0;
+};
+
+query_result query(const path& log_path, int64_t from, int64_t to, uint32_t levels) {
+    query_result result;
+    log_index::query(log_path, from, to, levels, [&](vstring line) {
+        ++result.lines;
+        if (line.find("[ERROR]") != vstring::npos) ++result.errors;
+        if (line == "continued") ++result.continued;
+        return true;
+    });
+    return result;
+}
+
+bool test_query() {
+    path log_path = "./index_test/query/";
+    std::error_code ec;
+    remove_all(log_path, ec);
+    std::tm tm = {};
+    tm.tm_year = 126;
+    tm.tm_mon = 0;
+    tm.tm_mday = 1;
+    tm.tm_hour = 8;
+    tm.tm_isdst = -1;
+    int64_t base = (int64_t)mktime(&tm) * 1000000;
+    int64_t from = base + 600 * 1000000LL, to = from + 180 * 1000000LL - 1;
+    size_t expect_lines = 0, expect_errors = 0, expect_continued = 0;
+    {
+        auto file = std::make_shared<log_dailyrollingfile>(log_path, "index", MAX_SIZE * 4);
+        file->set_index(true);
+        auto logmsg = std::make_shared<log_message>();
+        for (size_t i = 0; i < TEST_LINES; ++i) {
+            int64_t stamp = base + (int64_t)i * TEST_STEP;
+            bool error = i % 97 == 0, multi = i % 1000 == 0;
+            auto level = error ? log_level::LOG_LEVEL_ERROR : log_level::LOG_LEVEL_INFO;
+            auto text = fmt::format("message {}{}", i, multi ? "\ncontinued" : "");
+            logmsg->restore(level, stamp, text, "index", "", "", 0, false);
+            file->write(logmsg);
+            //行前缀的时间精确到毫秒
+            if (stamp / 1000 * 1000 >= from / 1000 * 1000 && stamp <= to) {
+                ++expect_lines;
+                if (error) ++expect_errors;
+                if (multi) ++expect_continued;
+            }
+        }
+    }
+    //索引有多个块，查询范围只覆盖其中一部分
+    size_t blocks = 0, matched = 0;
+    for (auto& entry : directory_iterator(log_path, ec)) {
+        if (entry.path().extension() != ".log") continue;
+        for (auto& block : log_index::load(entry.path())) {
+            ++blocks;
+            if (block.max_stamp >= from && block.min_stamp <= to) ++matched;
+        }
+    }
+    bool ok = blocks > 1 && matched > 0 && matched < blocks;
+    auto errors = query(log_path, from, to, 1 << (int)log_level::LOG_LEVEL_ERROR);
+    auto all = query(log_path, from, to, 0);
+    ok = ok && errors.lines == expect_errors && errors.errors == expect_errors;
+    ok = ok && all.lines == expect_lines + expect_continued && all.continued == expect_continued;
+    //提前停止
+    size_t limit = 0;
+    log_index::query(log_path, from, to, 0, [&](vstring) { return ++limit < 5; });
+    ok = ok && limit == 5;
+    //删除索引后整体扫描，结果应一致
+    for (auto& entry : directory_iterator(log_path, ec)) {
+        if (entry.path().extension() == ".idx") remove(entry.path(), ec);
+    }
+    auto scan_errors = query(log_path, from, to, 1 << (int)log_level::LOG_LEVEL_ERROR);
+    auto scan_all = query(log_path, from, to, 0);
+    ok = ok && scan_errors.lines == errors.lines && scan_all.lines == all.lines && scan_all.continued == all.continued;
+    std::cout << fmt::format("index query: blocks {}/{} errors {}/{} lines {}/{} continued {}/{} scan {}/{}{}",
+        matched, blocks, errors.lines, expect_errors, all.lines, expect_lines + expect_continued, all.continued, expect_continued,
+        scan_errors.lines, scan_all.lines, ok ? " ok" : " failed") << std::endl;
+    return ok;
+}
+
+//写入count条，消息体中带0的行也完整输出
+void write_lines(log_file_base& file, int64_t base, size_t begin, size_t count) {
+    auto logmsg = std::make_shared<log_message>();
+    for (size_t i = begin; i < begin + count; ++i) {
+        sstring text = fmt::format("message {}", i);
+        if (i % 1000 == 0) text.append(1, '\0').append("zero");
+        logmsg->restore(log_level::LOG_LEVEL_INFO, base + (int64_t)i * TEST_STEP, text, "index", "", "", 0, false);
+        file.write(logmsg);
+    }
+}
+
+bool test_reopen() {
+    path log_path = "./index_test/reopen/";
+    std::error_code ec;
+    remove_all(log_path, ec);
+    create_directories(log_path, ec);
+    int64_t base = (int64_t)time(nullptr) * 1000000;
+    const size_t count = 20000;
+    std::tm tm = {};
+    //崩溃：复制写入中的文件，末尾是预分配的0，索引没有最后一块
+    {
+        log_file_base file(MAX_SIZE * 4);
+        file.set_index(true);
+        file.create(log_path, "running.log", tm);
+        write_lines(file, base, 0, count);
+        copy_file(log_path / "running.log", log_path / "crash.log", ec);
+        copy_file(log_path / "running.log.idx", log_path / "crash.log.idx", ec);
+    }
+    remove(log_path / "running.log", ec);
+    remove(log_path / "running.log.idx", ec);
+    bool padded = file_size(log_path / "crash.log", ec) > count * 20;
+    {
+        log_file_base file(MAX_SIZE * 4);
+        file.set_index(true);
+        file.create(log_path, "crash.log", tm);
+        write_lines(file, base, count, count);
+    }
+    //开启索引前已有内容
+    {
+        log_file_base file(MAX_SIZE * 4);
+        file.create(log_path, "prefix.log", tm);
+        write_lines(file, base, 0, count);
+    }
+    {
+        log_file_base file(MAX_SIZE * 4);
+        file.set_index(true);
+        file.create(log_path, "prefix.log", tm);
+        write_lines(file, base, count, count);
+    }
+    size_t zeros = 0;
+    auto query_lines = [&](cpchar name) {
+        size_t lines = 0;
+        bool stop = false;
+        log_index::query_file(log_path / name, base, base + (int64_t)count * 2 * TEST_STEP, 0, [&](vstring line) {
+            ++lines;
+            if (line.find(vstring("\0zero", 5)) != vstring::npos) ++zeros;
+            return true;
+        }, stop);
+        return lines;
+    };
+    size_t crash = query_lines("crash.log"), prefix = query_lines("prefix.log");
+    bool ok = padded && crash == count * 2 && prefix == count * 2 && zeros == count * 2 / 1000 * 2;
+    std::cout << fmt::format("index reopen: crash {}/{} prefix {}/{} zero {}{}", crash, count * 2, prefix, count * 2,
+        zeros, ok ? " ok" : " failed") << std::endl;
+    return ok;
+}
+
+bool test_json() {
+    auto service = std::make_shared<log_service>();
+    service->option("./index_test/json/", "index", "1");
+    service->add_dest("text");
+    service->add_json_dest("json");
+    bool ok = service->set_dest_index("text", true) && !service->set_dest_index("json", true);
+    std::cout << "index json refused" << (ok ? " ok" : " failed") << std::endl;
+    return ok;
+}
+
+int main() {
+    bool ok = test_query();
+    ok = test_reopen() && ok;
+    ok = test_json() && ok;
+    return ok ? 0 : 1;
+}
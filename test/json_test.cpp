@@ -0,0 +1,105 @@
+//json_test.cpp
+//json转义与逐字节的参考实现对比，覆盖引号、反斜杠、控制字符、16字节块边界和块后的尾部
+//并检查json行的usec字段为微秒
+#include <random>
+#include "logger.h"
+
+using namespace logger;
+
+sstring json_expect(vstring str) {
+    sstring out;
+    for (unsigned char c : str) {
+        switch (c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        case '\b': out += "\\b"; break;
+        case '\f': out += "\\f"; break;
+        default:
+            if (c < 0x20) out += fmt::format("\\u{:04x}", c);
+            else out.push_back(c);
+            break;
+        }
+    }
+    return out;
+}
+
+sstring json_result(vstring str) {
+    sstring out(str.size() * 6, '\0');
+    char* end = json_escape(out.data(), str);
+    out.resize(end - out.data());
+    return out;
+}
+
+bool check(vstring str, size_t& total) {
+    ++total;
+    sstring expect = json_expect(str);
+    sstring result = json_result(str);
+    if (expect == result) return true;
+    std::cout << fmt::format("escape size {}: expect [{}] result [{}]", str.size(), expect, result) << std::endl;
+    return false;
+}
+
+bool test_escape() {
+    size_t total = 0, failed = 0;
+    //每种特殊字符放在0~47长度字符串的每个位置，跨越块内、块边界和尾部
+    const char specials[] = { '"', '\\', '\n', '\r', '\t', '\b', '\f', '\0', 0x01, 0x1F, 0x20, 0x7F, (char)0x80, (char)0xFF };
+    for (char special : specials) {
+        for (size_t size = 1; size < 48; ++size) {
+            for (size_t pos = 0; pos < size; ++pos) {
+                sstring str(size, 'a');
+                str[pos] = special;
+                if (!check(str, total)) ++failed;
+            }
+        }
+    }
+    //同一块内多个特殊字符，以及全部字节值
+    for (size_t size = 0; size < 48; ++size) {
+        if (!check(sstring(size, '"'), total)) ++failed;
+        if (!check(sstring(size, '\x1'), total)) ++failed;
+    }
+    sstring bytes;
+    for (int c = 0; c < 256; ++c) bytes.push_back((char)c);
+    for (size_t offset = 0; offset < 16; ++offset) {
+        if (!check(vstring(bytes).substr(offset), total)) ++failed;
+    }
+    //随机字符串
+    std::mt19937 rng(2024);
+    for (size_t i = 0; i < 10000; ++i) {
+        sstring str(rng() % 100, '\0');
+        for (auto& c : str) c = (char)(rng() % 4 == 0 ? rng() % 0x28 : rng() % 256);
+        if (!check(str, total)) ++failed;
+    }
+    std::cout << fmt::format("json escape: {}/{} {}", total - failed, total, failed ? "failed" : "ok") << std::endl;
+    return failed == 0;
+}
+
+bool test_usec() {
+    path log_path = "./json_test/";
+    std::error_code ec;
+    remove_all(log_path, ec);
+    auto logmsg = std::make_shared<log_message>();
+    logmsg->option(log_level::LOG_LEVEL_INFO, "usec", "json", "", "", 0);
+    {
+        auto dest = std::make_shared<log_dailyjsonfile>(log_path, "json", 1024 * 1024);
+        dest->write(logmsg);
+        dest->flush();
+    }
+    sstring line;
+    for (auto& entry : directory_iterator(log_path, ec)) {
+        std::ifstream ifs(entry.path());
+        std::getline(ifs, line);
+    }
+    auto expect = fmt::format("\"usec\":{},", logmsg->stamp() % 1000000);
+    bool ok = line.find(expect) != sstring::npos;
+    std::cout << fmt::format("json usec: {}{}", expect, ok ? " ok" : " failed") << std::endl;
+    return ok;
+}
+
+int main() {
+    bool ok = test_escape();
+    ok = test_usec() && ok;
+    return ok ? 0 : 1;
+}
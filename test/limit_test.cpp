@@ -0,0 +1,106 @@
+//limit_test.cpp
+//限流规则的令牌桶和采样计算，时间由测试注入
+#include "logger.h"
+
+using namespace logger;
+
+const int64_t SECOND = 1000000;
+
+size_t failed = 0;
+
+void expect(bool ok, cpchar name) {
+    if (!ok) {
+        ++failed;
+        std::cout << "limit " << name << " failed" << std::endl;
+    }
+}
+
+size_t allow_count(limit_rule& rule, size_t count, int64_t now) {
+    size_t allowed = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (rule.allow(now)) ++allowed;
+    }
+    return allowed;
+}
+
+void test_bucket() {
+    //每秒10条，突发5条
+    limit_rule rule(limit_type::TAG, "net", 10, 5, 0);
+    int64_t now = SECOND;
+    expect(allow_count(rule, 8, now) == 5, "bucket burst");
+    //100ms补充1个令牌
+    now += SECOND / 10;
+    expect(allow_count(rule, 3, now) == 1, "bucket refill");
+    //不足一个令牌的时间累计
+    now += SECOND / 20;
+    expect(allow_count(rule, 1, now) == 0, "bucket half token");
+    now += SECOND / 20;
+    expect(allow_count(rule, 1, now) == 1, "bucket accumulate");
+    //长时间空闲后不超过突发容量
+    now += 10 * SECOND;
+    expect(allow_count(rule, 10, now) == 5, "bucket cap");
+    //按速率匀速写入时全部放行
+    size_t allowed = 0;
+    for (size_t i = 0; i < 100; ++i) {
+        now += SECOND / 10;
+        allowed += allow_count(rule, 1, now);
+    }
+    expect(allowed == 100, "bucket steady");
+    expect(rule.report() == 3 + 2 + 1 + 5, "bucket report");
+    expect(rule.report() == 0, "bucket report reset");
+}
+
+void test_sample() {
+    //1/4采样，放行第0、4、8...条
+    limit_rule rule(limit_type::FEATURE, "login", 0, 0, 4);
+    bool ordered = true;
+    for (size_t i = 0; i < 100; ++i) {
+        if (rule.allow(SECOND) != (i % 4 == 0)) ordered = false;
+    }
+    expect(ordered, "sample order");
+    expect(rule.report() == 75, "sample report");
+    //采样后再限速：采样放行的日志还需要令牌
+    limit_rule both(limit_type::TAG, "db", 1, 1, 2);
+    expect(both.allow(SECOND), "sample bucket first");
+    expect(!both.allow(SECOND), "sample bucket sampled");
+    expect(!both.allow(SECOND), "sample bucket no token");
+    expect(!both.allow(SECOND), "sample bucket sampled again");
+    expect(both.allow(2 * SECOND), "sample bucket refill");
+    expect(both.report() == 3, "sample bucket report");
+}
+
+void test_limiter() {
+    log_limiter limiter;
+    limiter.set_limit(limit_type::TAG, "net", 0, 0, 2);
+    limiter.set_limit(limit_type::SOURCE, "test.lua:10", 0, 0, 3);
+    expect(limiter.enabled() && limiter.has_source(), "limiter enabled");
+    auto rules = limiter.rules();
+    size_t net = 0, other = 0, source = 0, line = 0;
+    for (size_t i = 0; i < 12; ++i) {
+        if (log_limiter::allow(*rules, "net", "", "", 0)) ++net;
+        if (log_limiter::allow(*rules, "db", "", "", 0)) ++other;
+        if (log_limiter::allow(*rules, "", "", "test.lua", 10)) ++source;
+        if (log_limiter::allow(*rules, "", "", "test.lua", 11)) ++line;
+    }
+    expect(net == 6 && other == 12 && source == 4 && line == 12, "limiter keys");
+    //未指定突发容量时为1秒的量
+    limiter.set_limit(limit_type::FEATURE, "login", 20, 0, 0);
+    size_t allowed = 0;
+    for (size_t i = 0; i < 50; ++i) {
+        if (log_limiter::allow(*limiter.rules(), "", "login", "", 0)) ++allowed;
+    }
+    expect(allowed >= 20 && allowed <= 21, "limiter default burst");
+    //速率和采样都为0时删除规则
+    limiter.set_limit(limit_type::TAG, "net", 0, 0, 0);
+    limiter.set_limit(limit_type::SOURCE, "test.lua:10", 0, 0, 0);
+    limiter.set_limit(limit_type::FEATURE, "login", 0, 0, 0);
+    expect(!limiter.enabled() && !limiter.has_source(), "limiter remove");
+}
+
+int main() {
+    test_bucket();
+    test_sample();
+    test_limiter();
+    std::cout << "limit test: " << (failed ? "failed" : "ok") << std::endl;
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,298 @@
+//log_bench.cpp
+//lualog基准测试：C++和lua输出的吞吐、调用延迟和入队到落盘延迟，结果输出为json
+//用法：log_bench [线程数] [每线程日志数] [json输出文件]
+#include <algorithm>
+#include "logger.h"
+
+using namespace logger;
+
+extern "C" int luaopen_lualog(lua_State* L);
+
+const size_t BENCH_COUNT = 200000;
+
+//lua基准循环，COUNT由测试程序设置
+cpchar LUA_PRINT = R"(
+    local log = require("lualog")
+    local print, lap, INFO = log.print, bench_lap, log.LOG_LEVEL.INFO
+    for i = 1, COUNT do
+        print(INFO, 0, "bench", "", "bench message {} {}", i, "text")
+        lap()
+    end
+)";
+
+cpchar LUA_TABLE = R"(
+    local log = require("lualog")
+    local print, lap, INFO, FORMAT = log.print, bench_lap, log.LOG_LEVEL.INFO, log.LOG_FLAG.FORMAT
+    local value = { id = 1001, name = "bench", items = { 1, 2, 3, 4, 5 }, pos = { x = 1.5, y = 2.5 } }
+    for i = 1, COUNT do
+        print(INFO, FORMAT, "bench", "", "bench table {} {}", i, value)
+        lap()
+    end
+)";
+
+cpchar LUA_MIXED = R"(
+    local log = require("lualog")
+    local print, lap = log.print, bench_lap
+    local INFO, ERROR = log.LOG_LEVEL.INFO, log.LOG_LEVEL.ERROR
+    for i = 1, COUNT do
+        print(i % 10 == 0 and ERROR or INFO, 0, "bench", i % 2 == 0 and "bench_fea" or "", "bench message {} {}", i, "text")
+        lap()
+    end
+)";
+
+//关闭级别的调用开销：print、按级别特化的函数、先检查enabled
+cpchar LUA_DISABLED_PRINT = R"(
+    local log = require("lualog")
+    local print, DEBUG = log.print, log.LOG_LEVEL.DEBUG
+    for i = 1, COUNT do
+        print(DEBUG, 0, "bench", "", "bench message {} {}", i, "text")
+    end
+)";
+
+cpchar LUA_DISABLED_LEVEL = R"(
+    local log = require("lualog")
+    local debug = log.logger("bench").debug
+    for i = 1, COUNT do
+        debug("bench message {} {}", i, "text")
+    end
+)";
+
+cpchar LUA_DISABLED_GUARD = R"(
+    local log = require("lualog")
+    local debug, enabled, DEBUG = log.logger("bench").debug, log.enabled, log.LOG_LEVEL.DEBUG
+    for i = 1, COUNT do
+        if enabled[DEBUG] then debug("bench message {} {}", i, "text") end
+    end
+)";
+
+//等待所有agent队列写完
+cpchar LUA_DRAIN = R"(
+    local log = require("lualog")
+    repeat
+        local busy = false
+        for _, agent in pairs(log.stats().agents) do
+            if agent.depth > 0 then busy = true end
+        end
+        bench_sleep(1)
+    until not busy
+)";
+
+cpchar LUA_LATENCY = R"(
+    return require("lualog").stats().latency.buckets
+)";
+
+struct bench_case {
+    cpchar name;
+    cpchar code;    //lua代码，为空时走C++的output_logger
+};
+
+struct bench_result {
+    sstring name;
+    size_t threads = 0;
+    size_t messages = 0;
+    double seconds = 0;
+    std::vector<uint32_t> laps;             //每次调用耗时(纳秒)
+    std::vector<size_t> latency;            //落盘延迟直方图增量
+};
+
+thread_local int64_t t_last = 0;
+thread_local std::vector<uint32_t> t_laps;
+
+int64_t now_ns() {
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+//记录与上次调用的间隔，即一次日志调用的耗时
+int bench_lap(lua_State* L) {
+    int64_t now = now_ns();
+    t_laps.push_back((uint32_t)(now - t_last));
+    t_last = now;
+    return 0;
+}
+
+int bench_sleep(lua_State* L) {
+    std::this_thread::sleep_for(milliseconds(lua_tointeger(L, 1)));
+    return 0;
+}
+
+lua_State* new_state() {
+    lua_State* L = luaL_newstate();
+    luaL_openlibs(L);
+    luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_PRELOAD_TABLE);
+    lua_pushcfunction(L, luaopen_lualog);
+    lua_setfield(L, -2, "lualog");
+    lua_pop(L, 1);
+    lua_register(L, "bench_lap", bench_lap);
+    lua_register(L, "bench_sleep", bench_sleep);
+    return L;
+}
+
+void run_lua(lua_State* L, cpchar code) {
+    if (luaL_dostring(L, code) != LUA_OK) {
+        std::cerr << "lua error: " << lua_tostring(L, -1) << std::endl;
+        exit(1);
+    }
+}
+
+std::vector<size_t> latency_buckets(lua_State* L) {
+    std::vector<size_t> buckets;
+    run_lua(L, LUA_LATENCY);
+    for (size_t i = 1; lua_rawgeti(L, -1, i) == LUA_TNUMBER; ++i) {
+        buckets.push_back(lua_tointeger(L, -1));
+        lua_pop(L, 1);
+    }
+    lua_pop(L, 2);
+    return buckets;
+}
+
+void bench_thread(const bench_case& bcase, size_t count, std::vector<uint32_t>& laps, int64_t& end) {
+    lua_State* L = new_state();
+    run_lua(L, "require('lualog').attach()");
+    t_laps.clear();
+    t_laps.reserve(count);
+    t_last = now_ns();
+    if (bcase.code) {
+        lua_pushinteger(L, count);
+        lua_setglobal(L, "COUNT");
+        run_lua(L, bcase.code);
+    } else {
+        for (size_t i = 0; i < count; ++i) {
+            output_logger(log_level::LOG_LEVEL_INFO, fmt::format("bench message {} {}", i, "text"), "bench", "", __FILE__, __LINE__);
+            bench_lap(L);
+        }
+    }
+    end = now_ns();
+    //线程退出会注销agent，先等待日志写完
+    run_lua(L, LUA_DRAIN);
+    laps.swap(t_laps);
+    lua_close(L);
+}
+
+bench_result run_case(lua_State* L, const bench_case& bcase, size_t threads, size_t count) {
+    bench_result result;
+    result.name = bcase.name;
+    result.threads = threads;
+    result.messages = threads * count;
+    auto before = latency_buckets(L);
+    std::vector<std::thread> workers;
+    std::vector<std::vector<uint32_t>> laps(threads);
+    std::vector<int64_t> ends(threads);
+    int64_t start = now_ns();
+    for (size_t i = 0; i < threads; ++i) {
+        workers.emplace_back(bench_thread, std::cref(bcase), count, std::ref(laps[i]), std::ref(ends[i]));
+    }
+    for (auto& worker : workers) worker.join();
+    //等待最后一批日志刷盘并计入延迟统计
+    std::this_thread::sleep_for(milliseconds(100));
+    result.seconds = (*std::max_element(ends.begin(), ends.end()) - start) / 1e9;
+    for (auto& lap : laps) {
+        result.laps.insert(result.laps.end(), lap.begin(), lap.end());
+    }
+    std::sort(result.laps.begin(), result.laps.end());
+    result.latency = latency_buckets(L);
+    for (size_t i = 0; i < result.latency.size() && i < before.size(); ++i) {
+        result.latency[i] -= before[i];
+    }
+    return result;
+}
+
+//单线程执行关闭级别的调用，返回每次调用的平均耗时(纳秒)
+double run_disabled(lua_State* L, cpchar code, size_t count) {
+    lua_pushinteger(L, count);
+    lua_setglobal(L, "COUNT");
+    int64_t start = now_ns();
+    run_lua(L, code);
+    return (double)(now_ns() - start) / count;
+}
+
+uint32_t lap_percentile(const std::vector<uint32_t>& laps, double q) {
+    if (laps.empty()) return 0;
+    return laps[std::min(laps.size() - 1, (size_t)(laps.size() * q))];
+}
+
+//返回分位所在区间的上界(微秒)
+size_t bucket_percentile(const std::vector<size_t>& buckets, double q) {
+    size_t total = 0, sum = 0;
+    for (auto count : buckets) total += count;
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        sum += buckets[i];
+        if (total > 0 && sum >= total * q) return (size_t)1 << i;
+    }
+    return 0;
+}
+
+void write_json(fmt::memory_buffer& buf, const bench_result& result, bool last) {
+    auto out = std::back_inserter(buf);
+    fmt::format_to(out, "    {{\"name\":\"{}\",\"threads\":{},\"messages\":{},\"seconds\":{:.6f},\"msgs_per_sec\":{:.0f},",
+        result.name, result.threads, result.messages, result.seconds, result.messages / result.seconds);
+    fmt::format_to(out, "\"caller_ns\":{{\"p50\":{},\"p99\":{},\"p999\":{}}},",
+        lap_percentile(result.laps, 0.5), lap_percentile(result.laps, 0.99), lap_percentile(result.laps, 0.999));
+    fmt::format_to(out, "\"e2e_us\":{{\"p50\":{},\"p99\":{},\"p999\":{}}}}}{}\n",
+        bucket_percentile(result.latency, 0.5), bucket_percentile(result.latency, 0.99), bucket_percentile(result.latency, 0.999), last ? "" : ",");
+    std::cerr << fmt::format("{:<16} threads:{:<3} {:>10.0f} msgs/s caller p50/p99/p999: {}/{}/{}ns e2e p50/p99/p999: <{}/<{}/<{}us",
+        result.name, result.threads, result.messages / result.seconds,
+        lap_percentile(result.laps, 0.5), lap_percentile(result.laps, 0.99), lap_percentile(result.laps, 0.999),
+        bucket_percentile(result.latency, 0.5), bucket_percentile(result.latency, 0.99), bucket_percentile(result.latency, 0.999)) << std::endl;
+}
+
+int main(int argc, char** argv) {
+    size_t threads = argc > 1 ? atoi(argv[1]) : 4;
+    size_t count = argc > 2 ? atoi(argv[2]) : BENCH_COUNT;
+    cpchar output = argc > 3 ? argv[3] : "log_bench.json";
+    //stdio目标输出到/dev/null
+    if (!freopen("/dev/null", "w", stdout)) return 1;
+    lua_State* L = new_state();
+    run_lua(L, R"(
+        local log = require("lualog")
+        log.option("./log_bench/", "bench", "1")
+        log.daemon(true)
+    )");
+    std::vector<bench_result> results;
+    std::vector<bench_case> cases = {
+        { "cpp_output", nullptr },
+        { "lua_print", LUA_PRINT },
+        { "lua_print_table", LUA_TABLE },
+    };
+    for (auto& bcase : cases) {
+        results.push_back(run_case(L, bcase, 1, count));
+        results.push_back(run_case(L, bcase, threads, count));
+    }
+    //主日志 + 级别目标 + feature目标 + 控制台
+    run_lua(L, R"(
+        local log = require("lualog")
+        log.add_lvl_dest(log.LOG_LEVEL.ERROR)
+        log.add_dest("bench_fea")
+        log.daemon(false)
+    )");
+    bench_case mixed = { "mixed_dests", LUA_MIXED };
+    results.push_back(run_case(L, mixed, 1, count));
+    results.push_back(run_case(L, mixed, threads, count));
+
+    run_lua(L, "local log = require('lualog') log.filter(log.LOG_LEVEL.DEBUG, false)");
+    std::vector<std::pair<cpchar, cpchar>> disabled_cases = {
+        { "lua_disabled_print", LUA_DISABLED_PRINT },
+        { "lua_disabled_level", LUA_DISABLED_LEVEL },
+        { "lua_disabled_guard", LUA_DISABLED_GUARD },
+    };
+    std::vector<std::pair<cpchar, double>> disabled;
+    for (auto& [name, code] : disabled_cases) {
+        disabled.emplace_back(name, run_disabled(L, code, count * 10));
+        std::cerr << fmt::format("{:<20} {:>8.1f} ns/call", name, disabled.back().second) << std::endl;
+    }
+
+    fmt::memory_buffer buf;
+    fmt::format_to(std::back_inserter(buf), "{{\n  \"count\":{},\n  \"results\":[\n", count);
+    for (size_t i = 0; i < results.size(); ++i) {
+        write_json(buf, results[i], i + 1 == results.size());
+    }
+    fmt::format_to(std::back_inserter(buf), "  ],\n  \"disabled\":[\n");
+    for (size_t i = 0; i < disabled.size(); ++i) {
+        fmt::format_to(std::back_inserter(buf), "    {{\"name\":\"{}\",\"ns_per_call\":{:.1f}}}{}\n",
+            disabled[i].first, disabled[i].second, i + 1 == disabled.size() ? "" : ",");
+    }
+    fmt::format_to(std::back_inserter(buf), "  ]\n}}\n");
+    std::ofstream ofs(output, std::ios::binary);
+    ofs.write(buf.data(), buf.size());
+    lua_close(L);
+    return ofs.good() ? 0 : 1;
+}
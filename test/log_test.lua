@@ -2,21 +2,35 @@
 local llog = require("lualog")
 
 local LOG_LEVEL     = llog.LOG_LEVEL
+local LOG_FLAG      = llog.LOG_FLAG
 
 llog.option("./newlog/", "qtest", 1, 1);
-llog.set_max_line(500000);
+llog.set_max_size(16 * 1024 * 1024);
 llog.daemon(true)
 
-llog.is_filter(LOG_LEVEL.DEBUG)
-llog.filter(LOG_LEVEL.DEBUG)
-
 llog.add_dest("qtest");
 llog.add_lvl_dest(LOG_LEVEL.ERROR)
 
+--按级别的日志函数
 llog.debug("aaaaaaaaaa")
-llog.info("bbbb")
-llog.warn("cccccc")
+llog.info("bbbb {}", 1)
+llog.warn("cccccc {} {}", "x", 2.5)
 llog.dump("dddddddddd")
-llog.error("eeeeeeeeeeee")
+llog.error("eeeeeeeeeeee {}", { a = 1, b = { 2, 3 } })
+
+--带tag和feature的logger
+local nlog = llog.logger("net", "qtest", LOG_FLAG.FORMAT)
+nlog.info("recv {} bytes", 128)
+nlog.error("send failed {}", "timeout")
+
+--enabled与过滤状态一致
+llog.filter(LOG_LEVEL.DEBUG, false)
+assert(llog.is_filter(LOG_LEVEL.DEBUG) and not llog.enabled[LOG_LEVEL.DEBUG])
+if llog.enabled[LOG_LEVEL.DEBUG] then nlog.debug("filtered {}", 1) end
+llog.filter(LOG_LEVEL.DEBUG, true)
+assert(not llog.is_filter(LOG_LEVEL.DEBUG) and llog.enabled[LOG_LEVEL.DEBUG])
+nlog.debug("debug {}", 2)
+
+llog.print(LOG_LEVEL.INFO, 0, "", "", "ffff")
 
 --os.exit()
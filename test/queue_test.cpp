@@ -0,0 +1,152 @@
+//queue_test.cpp
+//多线程压测spsc_queue和日志队列：BLOCK下不丢不重，DROP_OLDEST下写出与丢弃的合计不丢不重且丢弃计数准确
+//每个线程的日志保持顺序
+#include "logger.h"
+
+using namespace logger;
+
+const size_t TEST_COUNT = 1000000;
+const size_t TEST_THREADS = 4;
+const size_t TEST_LINES = 200000;
+
+//生产者队列满时等待，消费者线程批量取出，检查序号连续
+bool test_ring_block() {
+    spsc_queue<uint64_t> ring(1024);
+    std::atomic_bool done = false;
+    uint64_t expect = 0;
+    bool ordered = true;
+    std::thread consumer([&] {
+        while (true) {
+            bool finished = done;
+            size_t count = ring.drain([&](uint64_t&& value) {
+                if (value != expect) ordered = false;
+                expect = value + 1;
+            });
+            if (count == 0 && finished) break;
+        }
+    });
+    for (uint64_t i = 0; i < TEST_COUNT; ++i) {
+        while (!ring.push(uint64_t(i))) std::this_thread::yield();
+    }
+    done = true;
+    consumer.join();
+    bool ok = ordered && expect == TEST_COUNT && ring.empty();
+    std::cout << "ring block: " << expect << "/" << TEST_COUNT << (ok ? " ok" : " failed") << std::endl;
+    return ok;
+}
+
+//队列满时生产者从队头丢弃最旧的元素，取出和丢弃的元素合起来不丢不重
+bool test_ring_drop_oldest() {
+    spsc_queue<uint64_t> ring(1024);
+    std::atomic_bool done = false;
+    std::vector<uint64_t> consumed, stolen;
+    consumed.reserve(TEST_COUNT);
+    std::thread consumer([&] {
+        while (true) {
+            bool finished = done;
+            size_t count = ring.drain([&](uint64_t&& value) { consumed.push_back(value); });
+            if (count == 0 && finished) break;
+        }
+    });
+    for (uint64_t i = 0; i < TEST_COUNT; ++i) {
+        while (!ring.push(uint64_t(i))) {
+            uint64_t oldest;
+            if (ring.steal(oldest)) stolen.push_back(oldest);
+        }
+    }
+    done = true;
+    consumer.join();
+    //两边各自有序，归并后应恰好是全部序号
+    bool ok = std::is_sorted(consumed.begin(), consumed.end()) && std::is_sorted(stolen.begin(), stolen.end());
+    std::vector<uint64_t> all;
+    std::merge(consumed.begin(), consumed.end(), stolen.begin(), stolen.end(), std::back_inserter(all));
+    for (uint64_t i = 0; ok && i < all.size(); ++i) {
+        ok = all[i] == i;
+    }
+    ok = ok && all.size() == TEST_COUNT;
+    std::cout << "ring drop oldest: consumed " << consumed.size() << " stolen " << stolen.size() << (ok ? " ok" : " failed") << std::endl;
+    return ok;
+}
+
+//多个线程经日志服务写文件，读回后按线程检查序号
+struct line_check {
+    std::vector<std::vector<bool>> seen;
+    std::vector<int64_t> last;
+    size_t lines = 0, duplicated = 0, disorder = 0;
+
+    line_check(size_t threads, size_t count) : seen(threads, std::vector<bool>(count)), last(threads, -1) {}
+
+    void scan(const path& log_path) {
+        std::vector<path> files;
+        std::error_code ec;
+        for (auto& entry : recursive_directory_iterator(log_path, ec)) {
+            if (entry.is_regular_file(ec) && entry.path().extension() == ".log") {
+                files.push_back(entry.path());
+            }
+        }
+        std::sort(files.begin(), files.end());
+        for (auto& file : files) {
+            std::ifstream ifs(file);
+            sstring line;
+            while (std::getline(ifs, line)) {
+                size_t pos = line.find("] queue ");
+                if (pos == sstring::npos) continue;
+                size_t thread = 0, index = 0;
+                if (sscanf(line.c_str() + pos, "] queue %zu %zu", &thread, &index) != 2) continue;
+                if (thread >= seen.size() || index >= seen[thread].size()) continue;
+                ++lines;
+                if (seen[thread][index]) ++duplicated;
+                seen[thread][index] = true;
+                if ((int64_t)index <= last[thread]) ++disorder;
+                last[thread] = index;
+            }
+        }
+    }
+};
+
+bool test_service(overflow_policy policy, cpchar name) {
+    path log_path = fmt::format("./queue_test/{}/", name);
+    std::error_code ec;
+    remove_all(log_path, ec);
+    auto service = std::make_shared<log_service>();
+    service->set_queue_size(64);
+    service->set_overflow_policy(policy);
+    service->option(log_path.string().c_str(), name, "1");
+    service->daemon(true);
+    //agent在服务退出后再释放，保证队列中的日志都被写出
+    std::vector<sptr<log_agent>> agents;
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < TEST_THREADS; ++t) {
+        agents.push_back(std::make_shared<log_agent>());
+    }
+    for (size_t t = 0; t < TEST_THREADS; ++t) {
+        threads.emplace_back([&, t] {
+            agents[t]->attach(service);
+            for (size_t i = 0; i < TEST_LINES; ++i) {
+                agents[t]->output(log_level::LOG_LEVEL_INFO, fmt::format("queue {} {}", t, i), "", "");
+            }
+        });
+    }
+    for (auto& thread : threads) thread.join();
+    auto drops = service->get_drop_stats();
+    service = nullptr;
+    agents.clear();
+
+    line_check check(TEST_THREADS, TEST_LINES);
+    check.scan(log_path);
+    size_t dropped = drops[(int)log_level::LOG_LEVEL_INFO];
+    size_t total = TEST_THREADS * TEST_LINES;
+    bool ok = check.duplicated == 0 && check.disorder == 0 && check.lines + dropped == total;
+    if (policy == overflow_policy::BLOCK) ok = ok && dropped == 0;
+    std::cout << fmt::format("service {}: written {} dropped {} duplicated {} disorder {} total {}{}",
+        name, check.lines, dropped, check.duplicated, check.disorder, total, ok ? " ok" : " failed") << std::endl;
+    return ok;
+}
+
+int main() {
+    bool ok = test_ring_block();
+    ok = test_ring_drop_oldest() && ok;
+    ok = test_service(overflow_policy::BLOCK, "block") && ok;
+    ok = test_service(overflow_policy::DROP_OLDEST, "drop_oldest") && ok;
+    return ok ? 0 : 1;
+}
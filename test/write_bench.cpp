@@ -0,0 +1,61 @@
+//write_bench.cpp
+//测量日志线程写入目标的吞吐，每个线程独立写一个目标
+#include <numeric>
+#include "logger.h"
+
+using namespace logger;
+
+const size_t BENCH_COUNT = 1000000;
+
+double bench_dest(sptr<log_dest> dest, size_t count, size_t& bytes) {
+    auto logmsg = std::make_shared<log_message>();
+    sstring body(100, 'x');
+    logmsg->option(log_level::LOG_LEVEL_INFO, body, "bench", "", __FILE__, __LINE__);
+    auto start = steady_clock::now();
+    for (size_t i = 0; i < count; ++i) {
+        dest->write(logmsg);
+    }
+    dest->flush();
+    auto cost = duration_cast<duration<double>>(steady_clock::now() - start).count();
+    //前缀(日期.毫秒 + tag + 级别) + 正文 + 换行
+    bytes = count * (fmt::formatted_size("[0000-00-00 00:00:00.000][bench][INFO] ") + body.size() + 1);
+    return cost;
+}
+
+void report(cpchar name, size_t threads, size_t lines, size_t bytes, double cost) {
+    std::cerr << fmt::format("{:<8} threads:{} total:{:.1f}MB cost:{:.3f}s per-thread:{:.1f}MB/s {:.0f}Klines/s",
+        name, threads, bytes / 1048576.0, cost, bytes / 1048576.0 / cost / threads, lines / cost / threads / 1000) << std::endl;
+}
+
+//dest_type为文件目标类型，每个线程写独立目录
+template<class dest_type>
+void bench_file(cpchar name, size_t threads, size_t count) {
+    std::vector<std::thread> workers;
+    std::vector<size_t> bytes(threads);
+    auto start = steady_clock::now();
+    for (size_t i = 0; i < threads; ++i) {
+        workers.emplace_back([&, i]() {
+            path log_path = fmt::format("./write_bench/{}/{}", name, i);
+            auto dest = std::make_shared<dest_type>(log_path, "bench", 1024 * 1024 * 256);
+            bench_dest(dest, count, bytes[i]);
+        });
+    }
+    for (auto& worker : workers) worker.join();
+    auto cost = duration_cast<duration<double>>(steady_clock::now() - start).count();
+    report(name, threads, count * threads, std::accumulate(bytes.begin(), bytes.end(), (size_t)0), cost);
+}
+
+int main(int argc, char** argv) {
+    size_t threads = argc > 1 ? atoi(argv[1]) : 1;
+    size_t count = argc > 2 ? atoi(argv[2]) : BENCH_COUNT;
+    bench_file<log_dailyrollingfile>("file", threads, count);
+    //json目标按相同正文统计字节，便于和文本目标对比
+    bench_file<log_dailyjsonfile>("json", threads, count);
+
+    //stdio目标输出到/dev/null
+    if (!freopen("/dev/null", "w", stdout)) return 1;
+    size_t stdio_bytes = 0;
+    auto cost = bench_dest(std::make_shared<stdio_dest>(), count / 10, stdio_bytes);
+    report("stdio", 1, count / 10, stdio_bytes, cost);
+    return 0;
+}
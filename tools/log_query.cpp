@@ -0,0 +1,58 @@
+//log_query.cpp
+//按稀疏索引查询日志目录，只读取时间和级别匹配的部分
+//用法：log_query 日志目录 [开始时间] [结束时间] [级别,...]
+//时间为"2024-01-01 14:02:00"格式的本地时间或秒级时间戳，级别如"ERROR,FATAL"
+#include "logger.h"
+
+using namespace logger;
+
+//返回微秒时间戳，解析失败返回-1
+int64_t parse_time(cpchar text) {
+    std::tm tm = {};
+    if (sscanf(text, "%d-%d-%d %d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) == 6) {
+        tm.tm_year -= 1900;
+        tm.tm_mon -= 1;
+        tm.tm_isdst = -1;
+        return (int64_t)mktime(&tm) * 1000000;
+    }
+    char* end = nullptr;
+    double seconds = strtod(text, &end);
+    if (end == text || *end != '\0') return -1;
+    return (int64_t)(seconds * 1000000);
+}
+
+uint32_t parse_levels(cpchar text) {
+    uint32_t levels = 0;
+    auto names = level_names<log_level>()();
+    vstring list = text;
+    while (!list.empty()) {
+        size_t pos = list.find(',');
+        vstring name = list.substr(0, pos);
+        for (size_t i = 1; i < names.size(); ++i) {
+            if (name == names[i]) levels |= 1 << i;
+        }
+        list = pos == vstring::npos ? vstring() : list.substr(pos + 1);
+    }
+    return levels;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "usage: log_query log_path [from] [to] [LEVEL,...]" << std::endl;
+        return 1;
+    }
+    int64_t from = argc > 2 ? parse_time(argv[2]) : 0;
+    int64_t to = argc > 3 ? parse_time(argv[3]) : INT64_MAX;
+    uint32_t levels = argc > 4 ? parse_levels(argv[4]) : 0;
+    if (from < 0 || to < 0 || (argc > 4 && levels == 0)) {
+        std::cerr << "invalid time or level" << std::endl;
+        return 1;
+    }
+    size_t count = log_index::query(argv[1], from, to, levels, [](vstring line) {
+        fwrite(line.data(), 1, line.size(), stdout);
+        fputc('\n', stdout);
+        return true;
+    });
+    std::cerr << count << " lines" << std::endl;
+    return 0;
+}